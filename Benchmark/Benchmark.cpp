@@ -0,0 +1,429 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "Benchmark.h"
+#include "../IpcProtocol.h"
+#include "../StreamAgent.h"
+#include "../Metrics.h"
+#include "../StreamDictionary.h"
+#include <QApplication>
+#include <QBuffer>
+#include <QSettings>
+#include <QDir>
+#include <QImage>
+#include <QPainter>
+#include <QFile>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Synthetic, reproducible inputs for the hot paths. Output is one JSON line per benchmark:
+// {"bench":"...","n":...,"ns_per_op":...,"allocs_per_op":...}
+// Usage: DoorScopeEtlBench [-scale n] [-filter substring] [-replay protocol.log] [-sinks dsdx,null]
+
+static quint64 s_allocs = 0;
+
+#if defined(__GLIBC__)
+// Count every heap allocation including Qt's qMalloc by interposing malloc
+extern "C" void* __libc_malloc( size_t );
+extern "C" void* __libc_calloc( size_t, size_t );
+extern "C" void* __libc_realloc( void*, size_t );
+extern "C" void* malloc( size_t n ) throw() { s_allocs++; return __libc_malloc( n ); }
+extern "C" void* calloc( size_t n, size_t s ) throw() { s_allocs++; return __libc_calloc( n, s ); }
+extern "C" void* realloc( void* p, size_t n ) throw() { s_allocs++; return __libc_realloc( p, n ); }
+#else
+// Elsewhere only allocations through operator new are counted
+void* operator new( size_t n ) { s_allocs++; return ::malloc( n ); }
+void* operator new[]( size_t n ) { s_allocs++; return ::malloc( n ); }
+void operator delete( void* p ) throw() { ::free( p ); }
+void operator delete[]( void* p ) throw() { ::free( p ); }
+#endif
+
+quint64 allocCount()
+{
+	return s_allocs;
+}
+
+static QByteArray s_filter;
+
+void runBench( const char* name, BenchFunc f, int n )
+{
+	if( !s_filter.isEmpty() && !QByteArray( name ).contains( s_filter ) )
+		return;
+	if( n < 1 )
+		n = 1;
+	const quint64 allocs = s_allocs;
+	const quint64 start = Metrics::now();
+	f( n );
+	const quint64 ns = Metrics::now() - start;
+	const quint64 a = s_allocs - allocs;
+	printf( "{\"bench\":\"%s\",\"n\":%d,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f}\n",
+		name, n, double( ns ) / n, double( a ) / n );
+	fflush( stdout );
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static IpcProtocol* s_proto = 0;
+static QByteArray s_input;
+
+static QByteArray wireString( const QByteArray& str )
+{
+	return QByteArray::number( str.size() ) + "|" + str + "|";
+}
+
+static QByteArray randomText( int len )
+{
+	static const char* words[] = { "the", "system", "shall", "provide", "a", "means", "to", 
+		"record", "each", "requirement", "with", "its", "rationale", "and", "status", 0 };
+	int count = 0;
+	while( words[count] )
+		count++;
+	QByteArray res;
+	while( res.size() < len )
+	{
+		if( !res.isEmpty() )
+			res += ' ';
+		res += words[ qrand() % count ];
+	}
+	res.truncate( len );
+	return res;
+}
+
+static void parseInput( int )
+{
+	QBuffer in( &s_input );
+	in.open( QIODevice::ReadOnly );
+	s_proto->parse( &in );
+}
+
+static void protocolBench( const char* name, const QByteArray& cmd, int n, const QByteArray& prefix = QByteArray() )
+{
+	s_input = prefix;
+	for( int i = 0; i < n; i++ )
+		s_input += cmd;
+	runBench( name, parseInput, n );
+}
+
+static void protocolBenchmarks( int scale )
+{
+	const QByteArray shortStr = randomText( 12 );
+	const QByteArray longStr = randomText( 4000 );
+	protocolBench( "protocol/StringValName/short", "3|" + wireString( shortStr ) + wireString( "Object Heading" ), 20000 * scale );
+	protocolBench( "protocol/StringValName/long", "3|" + wireString( longStr ) + wireString( "Object Text" ), 2000 * scale );
+	protocolBench( "protocol/StringVal/short", "2|" + wireString( shortStr ), 20000 * scale );
+	protocolBench( "protocol/IntValName", "5|4711|" + wireString( "Absolute Number" ), 20000 * scale );
+	protocolBench( "protocol/BoolValName", "7|1|" + wireString( "~outline" ), 20000 * scale );
+	protocolBench( "protocol/RealValName", "11|3.141593|" + wireString( "~width" ), 20000 * scale );
+	protocolBench( "protocol/DateValName/date", "13|" + wireString( "2009-02-21" ) + wireString( "Created On" ), 20000 * scale );
+	protocolBench( "protocol/DateValName/datetime", "13|" + wireString( "2009-02-21 14:23:12" ) + wireString( "Last Modified On" ), 20000 * scale );
+	protocolBench( "protocol/Frame", "17|" + wireString( "obj" ) + "18|", 20000 * scale );
+	protocolBench( "protocol/Embed/nested", "19|17|" + wireString( "par" ) + "19|17|" + wireString( "rt" ) + 
+		"2|" + wireString( shortStr ) + "18|21|" + wireString( "x" ) + "18|21|" + wireString( "Object Text" ), 5000 * scale );
+	const QByteArray rtf = "{\\rtf1\\ansi\\ansicpg1252\\deff0{\\fonttbl{\\f0\\fswiss\\fcharset0 Arial;}"
+		"{\\f1\\froman\\fcharset2 Symbol;}}\\pard\\plain " + shortStr + " {\\b " + shortStr + "} {\\i " + 
+		shortStr + "}\\par\\pard\\li360\\fi-360{\\pntext\\f1\\'b7\\tab}{\\*\\pn\\pnlvlblt\\pnf1{\\pntxtb\\'b7}}" + 
+		longStr.left( 200 ) + "\\par}";
+	QByteArray batch;
+	for( int i = 0; i < 10; i++ )
+		batch += "5|4711|" + wireString( "Absolute Number" );
+	protocolBench( "protocol/Batch", "28|" + QByteArray::number( batch.size() ) + "|" + batch + "|", 2000 * scale );
+
+	// A typical object as sent by writeObjAttr, once with names and once with DefineName ids
+	static const char* attrs[] = { "Absolute Number", "Created By", "Created On", "Last Modified By", 
+		"Last Modified On", "Object Heading", "Object Text", "Object Short Text", "Priority", "Status", 0 };
+	QByteArray named = "17|" + wireString( "obj" );
+	QByteArray withIds = "37|0|";
+	QByteArray defs = "29|0|" + wireString( "obj" );
+	for( int i = 0; attrs[i]; i++ )
+	{
+		named += "3|" + wireString( shortStr ) + wireString( attrs[i] );
+		withIds += "30|" + wireString( shortStr ) + QByteArray::number( i + 1 ) + "|";
+		defs += "29|" + QByteArray::number( i + 1 ) + "|" + wireString( attrs[i] );
+	}
+	named += "18|";
+	withIds += "18|";
+	const int objs = 5000 * scale;
+	protocolBench( "protocol/object/names", named, objs );
+	protocolBench( "protocol/object/ids", withIds, objs, defs );
+	if( s_filter.isEmpty() || QByteArray( "protocol/object" ).contains( s_filter ) )
+		printf( "{\"bench\":\"protocol/object/size\",\"n\":%d,\"names_bytes_per_op\":%.1f,"
+			"\"ids_bytes_per_op\":%.1f}\n", objs, double( named.size() ), 
+			double( withIds.size() * objs + defs.size() ) / objs );
+	fflush( stdout );
+
+	protocolBench( "protocol/RichTextName", "27|" + wireString( rtf ) + wireString( "Object Text" ), 5000 * scale );
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static StreamAgent* s_agent = 0;
+static QString s_shortStr;
+static QString s_longStr;
+static QDateTime s_date;
+static QString s_smallImg;
+static QString s_largeImg;
+
+static void writeShortString( int n )
+{
+	for( int i = 0; i < n; i++ )
+		s_agent->writeString( s_shortStr, "Object Heading" );
+}
+
+static void writeLongString( int n )
+{
+	for( int i = 0; i < n; i++ )
+		s_agent->writeString( s_longStr, "Object Text" );
+}
+
+static void writeInt( int n )
+{
+	for( int i = 0; i < n; i++ )
+		s_agent->writeInt( i, "Absolute Number" );
+}
+
+static void writeDate( int n )
+{
+	for( int i = 0; i < n; i++ )
+		s_agent->writeDate( s_date, "Created On" );
+}
+
+static void writeFrame( int n )
+{
+	for( int i = 0; i < n; i++ )
+	{
+		s_agent->startFrame( "obj" );
+		s_agent->endFrame();
+	}
+}
+
+static void writeEmbed( int n )
+{
+	for( int i = 0; i < n; i++ )
+	{
+		s_agent->startEmbed();
+		s_agent->startFrame( "par" );
+		s_agent->startFrame( "rt" );
+		s_agent->writeChar( 'b' );
+		s_agent->writeString( s_shortStr );
+		s_agent->endFrame();
+		s_agent->endFrame();
+		s_agent->endEmbed( "Object Text" );
+	}
+}
+
+static void writeNestedEmbed( int n )
+{
+	const int depth = 4;
+	for( int i = 0; i < n; i++ )
+	{
+		for( int d = 0; d < depth; d++ )
+		{
+			s_agent->startEmbed();
+			s_agent->startFrame( "par" );
+			s_agent->writeString( s_shortStr );
+		}
+		for( int d = 0; d < depth; d++ )
+		{
+			s_agent->endFrame();
+			s_agent->endEmbed( "x" );
+		}
+	}
+}
+
+static void readSmallImg( int n )
+{
+	for( int i = 0; i < n; i++ )
+		s_agent->readImg( s_smallImg, 0, 0, "ole" );
+}
+
+static void readLargeImg( int n )
+{
+	for( int i = 0; i < n; i++ )
+		s_agent->readImg( s_largeImg, 0, 0, "ole" );
+}
+
+static void readDecodedImg( int n )
+{
+	s_agent->setPassthrough( false );
+	for( int i = 0; i < n; i++ )
+		s_agent->readImg( s_largeImg, 0, 0, "ole" );
+	s_agent->setPassthrough( true );
+}
+
+static void readScaledImg( int n )
+{
+	for( int i = 0; i < n; i++ )
+		s_agent->readImg( s_largeImg, 320, 240, "ole" );
+}
+
+static QString makeImage( const QString& name, int w, int h )
+{
+	QImage img( w, h, QImage::Format_RGB32 );
+	img.fill( 0xffffffff );
+	QPainter p( &img );
+	for( int i = 0; i < 64; i++ )
+	{
+		p.setPen( QColor( qrand() % 256, qrand() % 256, qrand() % 256 ) );
+		p.drawLine( qrand() % w, qrand() % h, qrand() % w, qrand() % h );
+	}
+	p.end();
+	const QString path = QDir::temp().absoluteFilePath( name );
+	img.save( path, "PNG" );
+	return path;
+}
+
+static void agentBenchmarks( int scale )
+{
+	s_shortStr = QString::fromLatin1( randomText( 12 ) );
+	s_longStr = QString::fromLatin1( randomText( 4000 ) );
+	s_date = QDateTime( QDate( 2009, 2, 21 ), QTime( 14, 23, 12 ) );
+	s_smallImg = makeImage( "DoorScopeEtlBench_small.png", 32, 32 );
+	s_largeImg = makeImage( "DoorScopeEtlBench_large.png", 2000, 1500 );
+
+	runBench( "agent/writeString/short", writeShortString, 50000 * scale );
+	runBench( "agent/writeString/long", writeLongString, 5000 * scale );
+	runBench( "agent/writeInt", writeInt, 50000 * scale );
+	runBench( "agent/writeDate", writeDate, 50000 * scale );
+	runBench( "agent/frame", writeFrame, 50000 * scale );
+	runBench( "agent/embed", writeEmbed, 10000 * scale );
+	runBench( "agent/embed/nested", writeNestedEmbed, 2000 * scale );
+	runBench( "image/small", readSmallImg, 2000 * scale );
+	runBench( "image/large", readLargeImg, 5 * scale );
+	runBench( "image/large/decode", readDecodedImg, 5 * scale ); // without ImagePassthrough
+	runBench( "image/large/scaled", readScaledImg, 5 * scale );
+
+	QFile::remove( s_smallImg );
+	QFile::remove( s_largeImg );
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Plain vs. dictionary encoded top level stream with a typical DOORS object:
+// many repeated attribute names, enum values and user names, unique texts.
+
+static QBuffer* s_dictOut = 0;
+static StreamDictionary::Encoder* s_dict = 0;
+
+static void writeObjects( int n )
+{
+	static const char* users[] = { "mueller", "meier", "schmid", "keller" };
+	static const char* states[] = { "draft", "reviewed", "approved" };
+	Stream::DataWriter out( s_dictOut );
+	if( s_dict )
+		s_dict->writeHeader( out );
+	for( int i = 0; i < n; i++ )
+	{
+		out.startFrame( "obj" );
+		const Stream::DataCell cells[] = {
+			Stream::DataCell().setInt32( i ),
+			Stream::DataCell().setString( users[ i % 4 ] ),
+			Stream::DataCell().setDateTime( s_date ),
+			Stream::DataCell().setString( users[ ( i / 3 ) % 4 ] ),
+			Stream::DataCell().setDateTime( s_date ),
+			Stream::DataCell().setString( states[ i % 3 ] ),
+			Stream::DataCell().setBool( i % 2 ),
+			Stream::DataCell().setString( s_shortStr + QString::number( i ) ) };
+		static const char* names[] = { "Absolute Number", "Created By", "Created On", "Last Modified By",
+			"Last Modified On", "Status", "~outline", "Object Heading" };
+		for( int j = 0; j < 8; j++ )
+		{
+			if( s_dict )
+				s_dict->writeSlot( out, names[j], cells[j] );
+			else
+				out.writeSlot( cells[j], names[j], true );
+		}
+		out.endFrame();
+	}
+}
+
+static void dictBenchmarks( int scale )
+{
+	const int n = 20000 * scale;
+	QBuffer buf;
+	buf.open( QIODevice::WriteOnly );
+	s_dictOut = &buf;
+
+	runBench( "dict/objects/plain", writeObjects, n );
+	const qint64 plain = buf.size();
+
+	buf.close();
+	buf.setData( QByteArray() );
+	buf.open( QIODevice::WriteOnly );
+	StreamDictionary::Encoder dict;
+	s_dict = &dict;
+	runBench( "dict/objects/dict", writeObjects, n );
+	const qint64 encoded = buf.size();
+	s_dict = 0;
+	s_dictOut = 0;
+
+	if( s_filter.isEmpty() || QByteArray( "dict/objects" ).contains( s_filter ) )
+		printf( "{\"bench\":\"dict/objects/size\",\"n\":%d,\"plain_bytes_per_op\":%.1f,"
+			"\"dict_bytes_per_op\":%.1f,\"names\":%d,\"values\":%d}\n", n, double( plain ) / n,
+			double( encoded ) / n, dict.getNameCount(), dict.getValueCount() );
+	fflush( stdout );
+}
+
+int main( int argc, char *argv[] )
+{
+	QApplication a( argc, argv, false );
+	a.setOrganizationName( "DoorScope" );
+	a.setApplicationName( "ETL-Bench" );
+
+	int scale = 1;
+	QString replay;
+	QString sinks = "dsdx";
+	const QStringList args = a.arguments();
+	for( int i = 1; i < args.size(); i++ )
+	{
+		if( args[i] == "-scale" && i + 1 < args.size() )
+			scale = args[++i].toInt();
+		else if( args[i] == "-filter" && i + 1 < args.size() )
+			s_filter = args[++i].toLatin1();
+		else if( args[i] == "-replay" && i + 1 < args.size() )
+			replay = args[++i];
+		else if( args[i] == "-sinks" && i + 1 < args.size() )
+			sinks = args[++i];
+	}
+
+	// Output goes to the temp directory; settings of the ETL application are not touched
+	QSettings set;
+	set.setValue( "OutDir", QDir::tempPath() );
+	set.setValue( "Sinks", sinks ); // "null" measures encoding without disk
+
+	qsrand( 4711 );
+
+	IpcProtocol proto( 0 );
+	s_proto = &proto;
+	proto.d_agent.open( "DoorScopeEtlBench_protocol" );
+	protocolBenchmarks( scale );
+	proto.d_agent.close();
+
+	StreamAgent agent;
+	s_agent = &agent;
+	agent.open( "DoorScopeEtlBench_agent" );
+	agentBenchmarks( scale );
+	agent.close();
+
+	dictBenchmarks( scale );
+
+	htmlBenchmarks( scale );
+
+	if( s_filter.isEmpty() || s_filter.startsWith( "transport" ) || QByteArray( "transport" ).contains( s_filter ) )
+		transportBenchmarks( scale, replay );
+
+	QDir::temp().remove( "DoorScopeEtlBench_protocol.dsdx" );
+	QDir::temp().remove( "DoorScopeEtlBench_agent.dsdx" );
+	return 0;
+}
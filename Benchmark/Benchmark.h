@@ -0,0 +1,37 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QtGlobal>
+
+// Runs f( n ) once and writes one JSON line with ns/op and allocations/op to stdout.
+// f has to perform n operations.
+typedef void (*BenchFunc)( int n );
+void runBench( const char* name, BenchFunc f, int n );
+
+// Number of heap allocations since program start
+quint64 allocCount();
+
+// Defined in HtmlBench.cpp
+void htmlBenchmarks( int scale );
+
+// Defined in TransportBench.cpp; replayPath may be empty
+class QString;
+void transportBenchmarks( int scale, const QString& replayPath );
+
+#endif // BENCHMARK_H
@@ -0,0 +1,57 @@
+
+TEMPLATE = app
+TARGET = DoorScopeEtlBench
+QT += network
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += .. ../.. ../../../Libraries
+
+	DESTDIR = ./tmp
+	OBJECTS_DIR = ./tmp
+	RCC_DIR = ./tmp
+	MOC_DIR = ./tmp
+
+win32 {
+	INCLUDEPATH += $$[QT_INSTALL_PREFIX]/include/Qt
+	DEFINES -= UNICODE
+ }else {
+	INCLUDEPATH += $$(HOME)/Programme/Qt-4.4.3/include/Qt
+	QMAKE_CXXFLAGS += -Wno-reorder -Wno-unused-parameter
+ }
+
+HEADERS += ../ConnectionScheduler.h \
+	../HtmlTokenizer.h \
+	../IpcProtocol.h \
+	../Metrics.h \
+	../OutputSink.h \
+	../Pipeline.h \
+	../Publisher.h \
+	../RichTextReader.h \
+	../SpillBuffer.h \
+	../StreamAgent.h \
+	../StreamDictionary.h \
+	../Tracer.h
+
+#Source files
+# HtmlBench.cpp includes HtmlImporter.cpp to get at its static functions
+SOURCES += ./Benchmark.cpp \
+	./HtmlBench.cpp \
+	./TransportBench.cpp \
+	../ConnectionScheduler.cpp \
+	../HtmlTokenizer.cpp \
+	../IpcProtocol.cpp \
+	../Metrics.cpp \
+	../OutputSink.cpp \
+	../Pipeline.cpp \
+	../Publisher.cpp \
+	../RichTextReader.cpp \
+	../SpillBuffer.cpp \
+	../StreamAgent.cpp \
+	../StreamDictionary.cpp \
+	../Tracer.cpp
+
+RESOURCES += ../DoorScopeEtl.qrc
+
+#Include file(s)
+include(../../Stream/Stream.pri)
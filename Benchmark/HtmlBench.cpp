@@ -0,0 +1,118 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "Benchmark.h"
+// The functions of interest are static; so the importer is compiled right into this file.
+#include "../HtmlImporter.cpp"
+#include <QTextStream>
+#include <QSettings>
+
+static Context* s_ctx = 0;
+static QString s_text;
+static int s_para = 0;
+static int s_table = 0;
+static int s_sink = 0;
+static QString s_htmlPath;
+
+static void benchSimplify( int n )
+{
+	for( int i = 0; i < n; i++ )
+		s_sink += simplify( s_text ).size();
+}
+
+static void benchCollectText( int n )
+{
+	for( int i = 0; i < n; i++ )
+		s_sink += collectText( s_ctx->parser, s_ctx->parser.at( s_para ) ).size();
+}
+
+static void benchGenerateHtml( int n )
+{
+	for( int i = 0; i < n; i++ )
+		s_sink += generateHtml( *s_ctx, s_ctx->parser.at( s_table ) ).size();
+}
+
+static void benchImport( int n )
+{
+	HtmlImporter imp;
+	for( int i = 0; i < n; i++ )
+		imp.parse( s_htmlPath );
+}
+
+static QString makeDocument( int sections )
+{
+	QString html;
+	QTextStream out( &html );
+	out << "<html><head><title>Benchmark Document</title></head><body>\n";
+	for( int s = 1; s <= sections; s++ )
+	{
+		out << "<h1>" << s << " Section " << s << "</h1>\n";
+		for( int h = 1; h <= 4; h++ )
+		{
+			out << "<h2>" << s << "." << h << " Heading</h2>\n";
+			for( int p = 0; p < 5; p++ )
+				out << "<p>The system <b>shall</b> provide a means to <i>record</i> each\n"
+					"requirement with its <u>rationale</u> and status H<sub>2</sub>O &amp; x<sup>2</sup>.</p>\n";
+			out << "<ul><li>first item</li><li>second <b>item</b></li></ul>\n";
+			out << "<table border=\"1\" width=\"100%\"><tr><th>Name</th><th>Value</th></tr>";
+			for( int r = 0; r < 4; r++ )
+				out << "<tr><td class=\"x\">Row " << r << "</td><td>" << r * 17 << "</td></tr>";
+			out << "</table>\n";
+		}
+	}
+	out << "</body></html>\n";
+	out.flush();
+	return html;
+}
+
+void htmlBenchmarks( int scale )
+{
+	for( int i = 0; i < 8; i++ )
+		s_text += "  The system\tshall   provide\n a means to record each   requirement ";
+	runBench( "html/simplify", benchSimplify, 50000 * scale );
+
+	QTextHtmlParser parser;
+	parser.parse( makeDocument( 2 ), 0 );
+	ImageCache images;
+	Context ctx( parser, &images );
+	s_ctx = &ctx;
+	for( int i = 0; i < ctx.parser.count(); i++ )
+	{
+		if( s_para == 0 && ctx.parser.at(i).id == Html_p )
+			s_para = i;
+		if( s_table == 0 && ctx.parser.at(i).id == Html_table )
+			s_table = i;
+	}
+	runBench( "html/collectText", benchCollectText, 50000 * scale );
+	runBench( "html/generateHtml", benchGenerateHtml, 10000 * scale );
+
+	s_htmlPath = QDir::temp().absoluteFilePath( "DoorScopeEtlBench.html" );
+	QFile f( s_htmlPath );
+	if( f.open( QIODevice::WriteOnly ) )
+	{
+		f.write( makeDocument( 50 ).toLatin1() );
+		f.close();
+		runBench( "html/import/doc", benchImport, 2 * scale );
+		// the same document with the chapters written one after the other
+		QSettings set;
+		set.setValue( "HtmlParallelChapters", false );
+		runBench( "html/import/doc/serial", benchImport, 2 * scale );
+		set.setValue( "HtmlParallelChapters", true );
+		QFile::remove( s_htmlPath );
+		QDir::temp().remove( "DoorScopeEtlBench.dsdx" );
+	}
+	s_ctx = 0;
+}
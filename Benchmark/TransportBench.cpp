@@ -0,0 +1,256 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "Benchmark.h"
+#include "../IpcProtocol.h"
+#include "../Metrics.h"
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QCoreApplication>
+#include <QFile>
+#include <QDir>
+#include <QSettings>
+#include <QTimer>
+#include <stdio.h>
+#include <algorithm>
+
+// Compares TCP loopback with the local socket (Unix domain socket resp. named pipe).
+// Both sides run in this process; the server side is a regular IpcProtocol.
+// The tcp-pipeline variant measures the single connection gain of the Pipeline setting.
+// The mixed variants measure the latency of a small client while a big export is parsed,
+// with and without the FairScheduling setting.
+
+static const char* s_localName = "DoorScopeEtlBench";
+static const quint64 s_timeoutNs = quint64( 60 ) * 1000000000; // per wait for the protocol
+
+struct Link
+{
+	QTcpServer tcpServer;
+	QLocalServer localServer;
+	QIODevice* client;
+	QIODevice* server;
+	Link():client(0),server(0){}
+	~Link() { delete client; delete server; }
+	bool connect( bool local );
+};
+
+bool Link::connect( bool local )
+{
+	if( local )
+	{
+		QLocalServer::removeServer( s_localName );
+		if( !localServer.listen( s_localName ) )
+			return false;
+		QLocalSocket* c = new QLocalSocket();
+		client = c;
+		c->connectToServer( s_localName );
+		if( !c->waitForConnected( 5000 ) || !localServer.waitForNewConnection( 5000 ) )
+			return false;
+		server = localServer.nextPendingConnection();
+		server->setParent( 0 );
+	}else
+	{
+		if( !tcpServer.listen( QHostAddress::LocalHost, 0 ) )
+			return false;
+		QTcpSocket* c = new QTcpSocket();
+		client = c;
+		c->connectToHost( QHostAddress::LocalHost, tcpServer.serverPort() );
+		if( !c->waitForConnected( 5000 ) || !tcpServer.waitForNewConnection( 5000 ) )
+			return false;
+		server = tcpServer.nextPendingConnection();
+		server->setParent( 0 );
+	}
+	return server != 0;
+}
+
+static bool isConnected( QIODevice* sock )
+{
+	if( QAbstractSocket* tcp = qobject_cast<QAbstractSocket*>( sock ) )
+		return tcp->state() == QAbstractSocket::ConnectedState;
+	if( QLocalSocket* local = qobject_cast<QLocalSocket*>( sock ) )
+		return local->state() == QLocalSocket::ConnectedState;
+	return sock->isOpen();
+}
+
+// Runs the event loop until the protocol has received target bytes; false if the
+// connection is lost or nothing arrives within s_timeoutNs
+static bool waitForBytes( IpcProtocol& proto, QIODevice* sock, quint64 target )
+{
+	QTimer tick; // so that WaitForMoreEvents returns to check the deadline
+	tick.start( 100 );
+	const quint64 deadline = Metrics::now() + s_timeoutNs;
+	while( proto.d_agent.d_metrics.d_bytesReceived < target )
+	{
+		if( !isConnected( sock ) || Metrics::now() > deadline )
+			return false;
+		QCoreApplication::processEvents( QEventLoop::WaitForMoreEvents );
+	}
+	return true;
+}
+
+// Sends data in chunks and waits until the protocol has consumed everything
+static bool transfer( Link& link, IpcProtocol& proto, const QByteArray& data, quint64& ns )
+{
+	const quint64 target = proto.d_agent.d_metrics.d_bytesReceived + data.size();
+	const quint64 start = Metrics::now();
+	link.client->write( data );
+	if( !waitForBytes( proto, link.server, target ) )
+		return false;
+	proto.waitForWriter();
+	ns += Metrics::now() - start;
+	return true;
+}
+
+static void transportBench( bool local, bool pipeline, const QByteArray& replay, int commands, int scale )
+{
+	const char* kind = ( local ) ? "local" : ( pipeline ) ? "tcp-pipeline" : "tcp";
+	QSettings set;
+	set.setValue( "Pipeline", pipeline );
+	Link link;
+	if( !link.connect( local ) )
+	{
+		printf( "{\"bench\":\"transport/%s\",\"error\":\"cannot connect\"}\n", kind );
+		return;
+	}
+	IpcProtocol proto( link.server );
+	proto.setParent( 0 ); // link owns the socket
+	set.setValue( "Pipeline", false );
+	QObject::connect( link.server, SIGNAL( readyRead() ), &proto, SLOT( onData() ) );
+	proto.d_agent.open( QString( "DoorScopeEtlBench_%1" ).arg( kind ) );
+
+	// Latency: one small command at a time
+	const QByteArray ping = "5|4711|15|Absolute Number|";
+	const int n = 2000 * scale;
+	quint64 ns = 0;
+	for( int i = 0; i < n; i++ )
+	{
+		if( !transfer( link, proto, ping, ns ) )
+		{
+			printf( "{\"bench\":\"transport/%s/latency\",\"error\":\"connection lost or timeout\"}\n", kind );
+			return;
+		}
+	}
+	printf( "{\"bench\":\"transport/%s/latency\",\"n\":%d,\"ns_per_op\":%.1f}\n", kind, n, double( ns ) / n );
+
+	// Throughput: the whole replay log at once
+	ns = 0;
+	for( int i = 0; i < scale; i++ )
+	{
+		if( !transfer( link, proto, replay, ns ) )
+		{
+			printf( "{\"bench\":\"transport/%s/replay\",\"error\":\"connection lost or timeout\"}\n", kind );
+			return;
+		}
+	}
+	const double secs = double( ns ) / 1000000000.0;
+	printf( "{\"bench\":\"transport/%s/replay\",\"n\":%d,\"ns_per_op\":%.1f,\"mb_per_s\":%.1f}\n", 
+		kind, commands * scale, double( ns ) / ( commands * scale ), 
+		double( replay.size() ) * scale / ( 1024.0 * 1024.0 ) / secs );
+	fflush( stdout );
+	proto.d_agent.close();
+	QDir::temp().remove( QString( "DoorScopeEtlBench_%1.dsdx" ).arg( kind ) );
+}
+
+static void mixedBench( bool fair, const QByteArray& replay, int scale )
+{
+	const char* kind = ( fair ) ? "fair" : "greedy";
+	QSettings set;
+	set.setValue( "FairScheduling", fair );
+	Link big, small;
+	if( !big.connect( false ) || !small.connect( false ) )
+	{
+		printf( "{\"bench\":\"transport/mixed/%s\",\"error\":\"cannot connect\"}\n", kind );
+		return;
+	}
+	IpcProtocol bigProto( big.server );
+	bigProto.setParent( 0 );
+	IpcProtocol smallProto( small.server );
+	smallProto.setParent( 0 );
+	set.setValue( "FairScheduling", false );
+	QObject::connect( big.server, SIGNAL( readyRead() ), &bigProto, SLOT( onData() ) );
+	QObject::connect( small.server, SIGNAL( readyRead() ), &smallProto, SLOT( onData() ) );
+	bigProto.d_agent.open( "DoorScopeEtlBench_big" );
+	smallProto.d_agent.open( "DoorScopeEtlBench_small" );
+
+	QByteArray burst;
+	for( int i = 0; i < 10; i++ )
+		burst += replay;
+	const quint64 bigTarget = bigProto.d_agent.d_metrics.d_bytesReceived + burst.size();
+	const QByteArray ping = "5|4711|15|Absolute Number|";
+	QList<quint64> lat;
+	for( int s = 0; s < scale; s++ )
+	{
+		big.client->write( burst );
+		QCoreApplication::processEvents();
+		for( int i = 0; i < 200; i++ )
+		{
+			quint64 ns = 0;
+			if( !transfer( small, smallProto, ping, ns ) )
+			{
+				printf( "{\"bench\":\"transport/mixed/%s\",\"error\":\"connection lost or timeout\"}\n", kind );
+				return;
+			}
+			lat.append( ns );
+		}
+	}
+	if( !waitForBytes( bigProto, big.server, bigTarget + quint64( burst.size() ) * ( scale - 1 ) ) )
+	{
+		printf( "{\"bench\":\"transport/mixed/%s\",\"error\":\"connection lost or timeout\"}\n", kind );
+		return;
+	}
+	std::sort( lat.begin(), lat.end() );
+	printf( "{\"bench\":\"transport/mixed/%s\",\"n\":%d,\"p50_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu}\n",
+		kind, lat.size(), (unsigned long long)lat[lat.size() / 2], 
+		(unsigned long long)lat[lat.size() * 99 / 100], (unsigned long long)lat.last() );
+	fflush( stdout );
+	bigProto.d_agent.close();
+	smallProto.d_agent.close();
+	QDir::temp().remove( "DoorScopeEtlBench_big.dsdx" );
+	QDir::temp().remove( "DoorScopeEtlBench_small.dsdx" );
+}
+
+void transportBenchmarks( int scale, const QString& replayPath )
+{
+	QByteArray replay;
+	int commands = 0;
+	if( !replayPath.isEmpty() )
+	{
+		// A log recorded with "Log Protocol on/off"
+		QFile f( replayPath );
+		if( !f.open( QIODevice::ReadOnly ) )
+		{
+			printf( "{\"bench\":\"transport\",\"error\":\"cannot open replay file\"}\n" );
+			return;
+		}
+		replay = f.readAll();
+		commands = replay.count( '|' ); // only a rough measure
+	}else
+	{
+		const QByteArray cmd = "3|11|hello world|14|Object Heading|5|4711|15|Absolute Number|";
+		commands = 20000;
+		for( int i = 0; i < commands / 2; i++ )
+			replay += cmd;
+	}
+	if( commands == 0 )
+		commands = 1;
+	transportBench( false, false, replay, commands, scale );
+	transportBench( false, true, replay, commands, scale );
+	transportBench( true, false, replay, commands, scale );
+	mixedBench( false, replay, scale );
+	mixedBench( true, replay, scale );
+}
@@ -0,0 +1,107 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+#include "ConnectionScheduler.h"
+#include "IpcProtocol.h"
+#include "Tracer.h"
+#include <QTimer>
+#include <QSettings>
+
+ConnectionScheduler::ConnectionScheduler()
+{
+	QSettings set;
+	d_budgetBytes = qMax( 1, set.value( "ParseBudgetBytes", 64 * 1024 ).toInt() );
+	d_budgetNs = quint64( qMax( 0, set.value( "ParseBudgetMs", 5 ).toInt() ) ) * 1000000;
+	d_policy = ( set.value( "SchedulingPolicy" ).toString() == "smallest" ) ? SmallestFirst : RoundRobin;
+	d_maxSkips = qMax( 1, set.value( "SchedulingMaxSkips", 16 ).toInt() );
+	d_timer = new QTimer( this );
+	d_timer->setInterval( 0 );
+	connect( d_timer, SIGNAL( timeout() ), this, SLOT( onSlice() ) );
+}
+
+ConnectionScheduler* ConnectionScheduler::instance()
+{
+	static ConnectionScheduler* s_inst = 0;
+	if( s_inst == 0 )
+		s_inst = new ConnectionScheduler();
+	return s_inst;
+}
+
+void ConnectionScheduler::schedule( IpcProtocol* p, QIODevice* sock )
+{
+	for( int i = 0; i < d_queue.size(); i++ )
+	{
+		if( d_queue[i].d_proto == p )
+			return; // already waiting for its turn
+	}
+	Entry e;
+	e.d_proto = p;
+	e.d_sock = sock;
+	d_queue.append( e );
+	if( !d_timer->isActive() )
+		d_timer->start();
+}
+
+void ConnectionScheduler::onSlice()
+{
+	// Closed connections are just dropped
+	while( !d_queue.isEmpty() && ( d_queue.first().d_proto.isNull() || d_queue.first().d_sock.isNull() ) )
+		d_queue.removeFirst();
+	if( d_queue.isEmpty() )
+	{
+		d_timer->stop();
+		return;
+	}
+	int next = 0;
+	if( d_policy == SmallestFirst )
+	{
+		quint64 min = 0;
+		for( int i = 0; i < d_queue.size(); i++ )
+		{
+			if( d_queue[i].d_proto.isNull() )
+				continue;
+			if( d_queue[i].d_skipped >= d_maxSkips )
+			{
+				// Aging; the queue is in arrival order, so the longest waiting comes first
+				next = i;
+				break;
+			}
+			const quint64 bytes = d_queue[i].d_proto->d_agent.d_metrics.d_bytesReceived;
+			if( i == 0 || bytes < min )
+			{
+				min = bytes;
+				next = i;
+			}
+		}
+		for( int i = 0; i < d_queue.size(); i++ )
+			if( i != next )
+				d_queue[i].d_skipped++;
+	}
+	Entry e = d_queue.takeAt( next );
+	e.d_skipped = 0;
+	if( e.d_proto.isNull() || e.d_sock.isNull() )
+		return;
+	const quint64 start = Metrics::now();
+	const bool more = e.d_proto->parse( e.d_sock, d_budgetBytes, d_budgetNs );
+	if( Tracer::isOn() )
+		Tracer::complete( "slice", "io", e.d_proto->getId(), start, Metrics::now() );
+	// The protocol object may be gone if the socket was closed during parse
+	if( more && !e.d_proto.isNull() && !e.d_sock.isNull() )
+		d_queue.append( e );
+	if( d_queue.isEmpty() )
+		d_timer->stop();
+}
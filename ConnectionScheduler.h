@@ -0,0 +1,63 @@
+#ifndef CONNECTIONSCHEDULER_H
+#define CONNECTIONSCHEDULER_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QObject>
+#include <QPointer>
+#include <QList>
+
+class IpcProtocol;
+class QIODevice;
+class QTimer;
+
+// Shares the event loop fairly among the connections (FairScheduling setting). Instead of
+// parsing everything available on readyRead, a connection is queued here and parses at
+// most ParseBudgetBytes resp. ParseBudgetMs per turn; if data is left it is queued again.
+// One turn is taken per event loop iteration, so the GUI and other sockets get their share.
+// The next connection is taken round robin, or with SchedulingPolicy "smallest" the one
+// which has received the fewest bytes of its current stream, i.e. small exports first;
+// a connection passed over SchedulingMaxSkips times is taken next, so big ones don't starve.
+class ConnectionScheduler : public QObject
+{
+	Q_OBJECT
+public:
+	enum Policy { RoundRobin, SmallestFirst };
+	static ConnectionScheduler* instance();
+
+	void schedule( IpcProtocol*, QIODevice* ); // the connection has data to parse
+	int getQueued() const { return d_queue.size(); }
+protected slots:
+	void onSlice();
+private:
+	ConnectionScheduler();
+	struct Entry
+	{
+		QPointer<IpcProtocol> d_proto;
+		QPointer<QIODevice> d_sock;
+		int d_skipped; // turns given to others while waiting, see SmallestFirst
+		Entry():d_skipped(0){}
+	};
+	QList<Entry> d_queue;
+	QTimer* d_timer;
+	qint64 d_budgetBytes;
+	quint64 d_budgetNs;
+	Policy d_policy;
+	int d_maxSkips;
+};
+
+#endif // CONNECTIONSCHEDULER_H
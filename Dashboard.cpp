@@ -0,0 +1,124 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "Dashboard.h"
+#include "IpcProtocol.h"
+#include "Metrics.h"
+#include <QTimer>
+#include <QHeaderView>
+#include <QSettings>
+#include <QStringList>
+
+static QString formatBytes( qint64 n )
+{
+	if( n < 0 )
+		return QString();
+	if( n >= 10 * 1024 * 1024 )
+		return QString( "%1 MB" ).arg( n / ( 1024 * 1024 ) );
+	if( n >= 10 * 1024 )
+		return QString( "%1 KB" ).arg( n / 1024 );
+	return QString( "%1 B" ).arg( n );
+}
+
+static QString formatElapsed( quint64 ns )
+{
+	const quint64 s = ns / 1000000000;
+	return QString( "%1:%2:%3" ).arg( s / 3600 ).arg( ( s / 60 ) % 60, 2, 10, QChar('0') ).
+		arg( s % 60, 2, 10, QChar('0') );
+}
+
+Dashboard::Dashboard( QWidget* parent ):QTableWidget( 0, MaxColumn, parent )
+{
+	setHorizontalHeaderLabels( QStringList() << tr("Peer") << tr("Module") << tr("Bytes/s") <<
+		tr("Objects/s") << tr("Images") << tr("Embed Depth") << tr("Output") << tr("Elapsed") );
+	verticalHeader()->hide();
+	setEditTriggers( QAbstractItemView::NoEditTriggers );
+	setSelectionMode( QAbstractItemView::NoSelection );
+	horizontalHeader()->setStretchLastSection( true );
+
+	d_timer = new QTimer( this );
+	connect( d_timer, SIGNAL( timeout() ), this, SLOT( onRefresh() ) );
+	QSettings set;
+	d_timer->start( set.value( "DashboardInterval", 1000 ).toInt() ); // ms
+}
+
+void Dashboard::addConnection( IpcProtocol* p )
+{
+	Entry e;
+	e.d_proto = p;
+	e.d_at = Metrics::now();
+	d_entries.append( e );
+	insertRow( rowCount() );
+	setCell( rowCount() - 1, Peer, p->getPeer() );
+}
+
+void Dashboard::setCell( int row, int col, const QString& text )
+{
+	QTableWidgetItem* i = item( row, col );
+	if( i == 0 )
+	{
+		i = new QTableWidgetItem();
+		if( col != Peer && col != Module )
+			i->setTextAlignment( Qt::AlignRight | Qt::AlignVCenter );
+		setItem( row, col, i );
+	}
+	if( i->text() != text )
+		i->setText( text );
+}
+
+void Dashboard::onRefresh()
+{
+	const quint64 now = Metrics::now();
+	for( int row = d_entries.size() - 1; row >= 0; row-- )
+	{
+		Entry& e = d_entries[row];
+		if( e.d_proto.isNull() )
+		{
+			// Connection is gone
+			d_entries.removeAt( row );
+			removeRow( row );
+			continue;
+		}
+		// With the Pipeline the agent is written by another thread
+		const IpcProtocol::Snapshot s = e.d_proto->snapshot();
+		const Metrics& m = s.d_metrics;
+		const Metrics& live = e.d_proto->d_agent.d_metrics;
+		const quint32 curBytes = quint32( int( live.d_liveBytes ) );
+		const quint32 curObjects = quint32( int( live.d_liveObjects ) );
+		// Counters are reset on CloseStream
+		const quint32 bytes = ( curBytes >= e.d_bytes ) ? curBytes - e.d_bytes : curBytes;
+		const quint32 objects = ( curObjects >= e.d_objects ) ? curObjects - e.d_objects : curObjects;
+		const double secs = double( now - e.d_at ) / 1000000000.0;
+		if( m.d_opened == 0 || secs <= 0.0 )
+		{
+			setCell( row, Module, tr("(idle)") );
+			setCell( row, BytesRate, QString() );
+			setCell( row, ObjectRate, QString() );
+		}else
+		{
+			setCell( row, Module, s.d_name );
+			setCell( row, BytesRate, formatBytes( qint64( bytes / secs ) ) );
+			setCell( row, ObjectRate, QString::number( qint64( objects / secs ) ) );
+		}
+		setCell( row, Images, QString::number( int( live.d_liveImages ) ) );
+		setCell( row, EmbedDepth, QString::number( s.d_embedDepth ) );
+		setCell( row, OutputSize, formatBytes( e.d_proto->d_agent.getOutputSize() ) ); // locked
+		setCell( row, Elapsed, ( m.d_opened == 0 ) ? QString() : formatElapsed( now - m.d_opened ) );
+		e.d_bytes = curBytes;
+		e.d_objects = curObjects;
+		e.d_at = now;
+	}
+}
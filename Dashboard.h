@@ -0,0 +1,55 @@
+#ifndef DASHBOARD_H
+#define DASHBOARD_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QTableWidget>
+#include <QPointer>
+
+class IpcProtocol;
+class QTimer;
+
+// One row per active connection of this process. The table is refreshed by a timer;
+// nothing is signalled from the protocol hot path. Bytes, objects and images come from
+// the atomic live counters of Metrics and are current also with the Pipeline. The module
+// name, embed depth and open time come from IpcProtocol::snapshot, which lags the writer
+// thread by up to one publish interval of the Pipeline.
+class Dashboard : public QTableWidget
+{
+	Q_OBJECT
+public:
+	enum Column { Peer, Module, BytesRate, ObjectRate, Images, EmbedDepth, OutputSize, Elapsed, MaxColumn };
+
+	Dashboard( QWidget* parent = 0 );
+	void addConnection( IpcProtocol* );
+protected slots:
+	void onRefresh();
+private:
+	struct Entry
+	{
+		QPointer<IpcProtocol> d_proto;
+		quint32 d_bytes; // live counters at the previous refresh
+		quint32 d_objects;
+		quint64 d_at;
+		Entry():d_bytes(0),d_objects(0),d_at(0) {}
+	};
+	void setCell( int row, int col, const QString& );
+	QList<Entry> d_entries; // same order as the rows
+	QTimer* d_timer;
+};
+
+#endif // DASHBOARD_H
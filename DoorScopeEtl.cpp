@@ -15,8 +15,10 @@
 */
 
 #include "DoorScopeEtl.h"
-#include <QTextEdit>
+#include <QListView>
+#include <QActionGroup>
 #include <QTcpServer>
+#include <QLocalServer>
 #include <QSettings>
 #include <QMenuBar>
 #include <QMenu>
@@ -25,15 +27,25 @@
 #include <QDir>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QStatusBar>
+#include <QSplitter>
+#include <QTcpSocket>
+#include <QLocalSocket>
 #include "IpcProtocol.h"
 #include "HtmlImporter.h"
+#include "Tracer.h"
+#include "ShardedServer.h"
+#include "Dashboard.h"
+#include "Publisher.h"
+#include "LogModel.h"
 
 static const int s_doorsDefaultPort = 5093;
+static const char* s_defaultLocalName = "DoorScopeEtl";
 static const char* s_version = "0.6.2";
 static const char* s_date = "2017-01-03";
 
 DoorScopeEtl::DoorScopeEtl(QWidget *parent, Qt::WFlags flags)
-	: QMainWindow(parent, flags)
+	: QMainWindow(parent, flags), d_supervisor( 0 ), d_workerCount( 0 )
 {
 	QSettings set;
 
@@ -49,34 +61,75 @@ DoorScopeEtl::DoorScopeEtl(QWidget *parent, Qt::WFlags flags)
 
 	QMenu* settings = menuBar()->addMenu ( tr( "&Settings" ) );
 	settings->addAction( tr( "Set &Port..." ), this, SLOT( onSetPort() ) );
+	d_localhostOnly = new QAction( tr( "Accept TCP from Localhost only" ), this );
+	d_localhostOnly->setCheckable( true );
+	d_localhostOnly->setChecked( set.value( "IpcLocalhostOnly", false ).toBool() );
+	connect( d_localhostOnly, SIGNAL( triggered() ), this, SLOT( onLocalhostOnly() ) );
+	settings->addAction( d_localhostOnly );
+	settings->addAction( tr( "Set &Local Socket Name..." ), this, SLOT( onSetLocalName() ) );
 	settings->addAction( tr( "Set &Output Directory..." ), this, SLOT( onSetOutDir() ) );
+	settings->addAction( tr( "Set &Staging Directory..." ), this, SLOT( onSetStagingDir() ) );
 
 	QMenu* log = menuBar()->addMenu( tr( "&Log" ) );
 	log->addAction( tr( "&Clear Log" ), this, SLOT( onClearLog() ), tr("CTRL+DEL") );
+	log->addAction( tr( "&Save Log..." ), this, SLOT( onSaveLog() ) );
+	QActionGroup* show = new QActionGroup( this );
+	const int minKind = set.value( "LogMinKind", LogTrace ).toInt();
+	const QString showNames[] = { tr( "Show &All" ), tr( "Show Status and &Errors" ), tr( "Show &Errors only" ) };
+	log->addSeparator();
+	for( int k = LogTrace; k <= LogError; k++ )
+	{
+		QAction* a = show->addAction( showNames[k] );
+		a->setCheckable( true );
+		a->setChecked( k == minKind );
+		a->setData( k );
+		log->addAction( a );
+	}
+	connect( show, SIGNAL( triggered( QAction* ) ), this, SLOT( onShowLog( QAction* ) ) );
+	log->addSeparator();
 	d_logTrace = new QAction( tr( "Trace on/off" ), this );
 	d_logTrace->setCheckable( true );
 	d_logTrace->setChecked( set.value( "LogTrace", false ).toBool() );
+	StreamAgent::setTrace( d_logTrace->isChecked() );
 	connect( d_logTrace, SIGNAL( triggered() ), this, SLOT( onLogTrace() ) );
 	log->addAction( d_logTrace );
 	d_logProto = new QAction( tr( "Log Protocol on/off" ), this );
 	d_logProto->setCheckable( true );
 	connect( d_logProto, SIGNAL( triggered() ), this, SLOT( onLogProto() ) );
 	log->addAction( d_logProto );
+	d_chromeTrace = new QAction( tr( "Chrome Trace on/off" ), this );
+	d_chromeTrace->setCheckable( true );
+	connect( d_chromeTrace, SIGNAL( triggered() ), this, SLOT( onChromeTrace() ) );
+	log->addAction( d_chromeTrace );
 
 	QMenu* info = menuBar()->addMenu( tr( "&?" ) );
 	info->addAction( tr( "&About DoorScope ETL..." ), this, SLOT( onAbout() ) );
 
-	d_log = new QTextEdit( this );
-	d_log->setReadOnly( true );
-	// d_log->setWordWrapMode( QTextOption::NoWrap );
-	setCentralWidget( d_log );
+	QSplitter* split = new QSplitter( Qt::Vertical, this );
+	d_dashboard = new Dashboard( split );
+	d_logModel = new LogModel( this );
+	d_logModel->setMinKind( minKind );
+	d_log = new QListView( split );
+	d_log->setUniformItemSizes( true ); // only the visible rows are laid out
+	d_log->setModel( d_logModel );
+	connect( d_logModel, SIGNAL( rowsInserted( const QModelIndex&, int, int ) ), d_log, SLOT( scrollToBottom() ) );
+	split->setStretchFactor( 1, 1 );
+	setCentralWidget( split );
 
 	d_server = new QTcpServer( this );
 	connect( d_server, SIGNAL( newConnection ()), this, SLOT( onNewConnection() ) );
 
 	updatePort();
 
+	d_local = new QLocalServer( this );
+	connect( d_local, SIGNAL( newConnection ()), this, SLOT( onNewLocalConnection() ) );
+
+	updateLocalName();
+
 	onLog( "Output directory: " + set.value( "OutDir", QDir::currentPath() ).toString(), LogStatus );
+	if( !set.value( "StagingDir" ).toString().isEmpty() )
+		onLog( "Staging directory: " + set.value( "StagingDir" ).toString(), LogStatus );
+	connect( Publisher::instance(), SIGNAL( log( QString, int ) ), this, SLOT( onLog( QString, int ) ) );
 	if( set.contains( "WindowSize" ) )
 		resize( set.value( "WindowSize" ).toSize() );
 
@@ -85,7 +138,7 @@ DoorScopeEtl::DoorScopeEtl(QWidget *parent, Qt::WFlags flags)
 
 DoorScopeEtl::~DoorScopeEtl()
 {
-
+	Tracer::stop();
 }
 
 void DoorScopeEtl::resizeEvent( QResizeEvent * event )
@@ -105,6 +158,19 @@ void DoorScopeEtl::onSetOutDir()
 	onLog( "Output directory: " + path, LogStatus );
 }
 
+void DoorScopeEtl::onSetStagingDir()
+{
+	QSettings set;
+	QString path = QFileDialog::getExistingDirectory( this, 
+		tr("Select local Staging Directory or cancel to write directly - DoorScope ETL"), 
+		set.value( "StagingDir" ).toString() );
+	set.setValue( "StagingDir", path );
+	if( path.isEmpty() )
+		onLog( "Staging directory: none; writing directly to the output directory", LogStatus );
+	else
+		onLog( "Staging directory: " + path, LogStatus );
+}
+
 void DoorScopeEtl::onSetPort()
 {
 	bool ok;
@@ -124,25 +190,125 @@ void DoorScopeEtl::updatePort()
 	if( d_server->isListening() )
 		d_server->close();
 
-	if( !d_server->listen( QHostAddress::Any, set.value( "IpcPort", s_doorsDefaultPort ).toInt() ) )
+	if( d_supervisor )
+	{
+		// The workers own the port
+		d_supervisor->start( d_workerCount, set.value( "IpcPort", s_doorsDefaultPort ).toInt(), 
+			d_localhostOnly->isChecked() );
+		return;
+	}
+
+	const QHostAddress addr = ( d_localhostOnly->isChecked() ) ? QHostAddress::LocalHost : QHostAddress::Any;
+	if( !d_server->listen( addr, set.value( "IpcPort", s_doorsDefaultPort ).toInt() ) )
 		onLog( d_server->errorString(), LogError );
 	else
-		onLog( "Listening on port " + QString::number( d_server->serverPort() ), LogStatus );
+		onLog( "Listening on " + addr.toString() + " port " + QString::number( d_server->serverPort() ), LogStatus );
 }
 
-void DoorScopeEtl::onNewConnection()
+void DoorScopeEtl::startWorkers( int count )
 {
-	QTcpSocket* sock = d_server->nextPendingConnection(); 
-	if( sock == 0 )
+	if( count < 1 )
 		return;
-	IpcProtocol* p = new IpcProtocol( sock );
-	connect( sock, SIGNAL( disconnected() ), sock, SLOT( deleteLater() ) );
+	if( !Supervisor::isSupported() )
+	{
+		onLog( "Worker processes are not supported on this platform", LogError );
+		return;
+	}
+	d_workerCount = count;
+	d_supervisor = new Supervisor( this );
+	connect( d_supervisor, SIGNAL( log( QString, int ) ), this, SLOT( onLog( QString, int ) ) );
+	connect( d_supervisor, SIGNAL( status( QString ) ), statusBar(), SLOT( showMessage( QString ) ) );
+	updatePort();
+}
+
+void DoorScopeEtl::updateLocalName()
+{
+	QSettings set;
+
+	if( d_local->isListening() )
+		d_local->close();
+
+	const QString name = set.value( "IpcLocalName", s_defaultLocalName ).toString();
+	if( name.isEmpty() )
+		return; // local socket disabled
+	if( !d_local->listen( name ) )
+	{
+		// A socket file left behind by a crashed instance doesn't accept connections;
+		// only then it is removed, so a running instance keeps its socket
+		QLocalSocket probe;
+		probe.connectToServer( name );
+		if( probe.waitForConnected( 1000 ) )
+		{
+			probe.disconnectFromServer();
+			onLog( "Local socket " + name + " is in use by another instance", LogError );
+			return;
+		}
+		QLocalServer::removeServer( name );
+		if( !d_local->listen( name ) )
+		{
+			onLog( d_local->errorString(), LogError );
+			return;
+		}
+	}
+	onLog( "Listening on local socket " + d_local->fullServerName(), LogStatus );
+}
+
+void DoorScopeEtl::onSetLocalName()
+{
+	QSettings set;
+	bool ok;
+	const QString name = QInputDialog::getText( this, tr( "Set Local Socket Name - DoorScope ETL" ), 
+		tr( "Enter a local socket name (empty disables it):" ), QLineEdit::Normal, 
+		set.value( "IpcLocalName", s_defaultLocalName ).toString(), &ok );
+	if( !ok )
+		return;
+	set.setValue( "IpcLocalName", name );
+	updateLocalName();
+}
+
+void DoorScopeEtl::onLocalhostOnly()
+{
+	QSettings set;
+	set.setValue( "IpcLocalhostOnly", d_localhostOnly->isChecked() );
+	updatePort();
+}
+
+void DoorScopeEtl::setupConnection( QIODevice* sock, IpcProtocol* p )
+{
 	if( d_logProto->isChecked() )
 		connect( sock, SIGNAL(readyRead()), this, SLOT(onData()) ); 
 	else
+	{
 		connect( sock, SIGNAL(readyRead()), p, SLOT(onData()) ); 
-	connect( sock, SIGNAL(error(QAbstractSocket::SocketError)), p, SLOT(onError(QAbstractSocket::SocketError)));
+		connect( sock, SIGNAL( disconnected() ), p, SLOT( onDisconnected() ) );
+	}
+	connect( sock, SIGNAL( disconnected() ), sock, SLOT( deleteLater() ) );
 	connect( &p->d_agent, SIGNAL( log( QString, int ) ), this, SLOT( onLog( QString, int ) ) );
+	if( QTcpSocket* tcp = qobject_cast<QTcpSocket*>( sock ) )
+		p->setPeer( QString( "%1:%2" ).arg( tcp->peerAddress().toString() ).arg( tcp->peerPort() ) );
+	else
+		p->setPeer( "local " + d_local->fullServerName() );
+	d_dashboard->addConnection( p );
+}
+
+void DoorScopeEtl::onNewConnection()
+{
+	QTcpSocket* sock = d_server->nextPendingConnection(); 
+	if( sock == 0 )
+		return;
+	IpcProtocol* p = new IpcProtocol( sock );
+	setupConnection( sock, p );
+	connect( sock, SIGNAL(error(QAbstractSocket::SocketError)), p, SLOT(onError(QAbstractSocket::SocketError)));
+}
+
+void DoorScopeEtl::onNewLocalConnection()
+{
+	QLocalSocket* sock = d_local->nextPendingConnection(); 
+	if( sock == 0 )
+		return;
+	IpcProtocol* p = new IpcProtocol( sock );
+	setupConnection( sock, p );
+	connect( sock, SIGNAL(error(QLocalSocket::LocalSocketError)), p, SLOT(onLocalError(QLocalSocket::LocalSocketError)));
 }
 
 void DoorScopeEtl::onTest()
@@ -160,7 +326,7 @@ void DoorScopeEtl::onTest()
 
 void DoorScopeEtl::onData()
 {
-	QTcpSocket* sock = (QTcpSocket*) sender();
+	QIODevice* sock = (QIODevice*) sender();
 	QFile out( d_logPath );
 	out.open( QIODevice::Append );
 	out.write( sock->readAll() );
@@ -168,37 +334,44 @@ void DoorScopeEtl::onData()
 
 void DoorScopeEtl::onLog( QString str, int kind )
 {
-	switch( kind )
-	{
-	case LogTrace:
-		if( !d_logTrace->isChecked() )
-			return;
-		str = ">>> " + str;
-		break;
-	case LogStatus:
-		str = "*** " + str;
-		break;
-	case LogError:
-		str = "### " + str;
-		break;
-	}
+	if( kind == LogTrace && !d_logTrace->isChecked() )
+		return;
 #ifdef _DEBUG
 	//QByteArray tmp = str.toLatin1();
 	//qDebug( tmp.data() );
 #endif
-	d_log->append( str );
-	d_log->moveCursor( QTextCursor::End );
+	d_logModel->append( str, kind );
 }
 
 void DoorScopeEtl::onClearLog()
 {
-	d_log->clear();
+	d_logModel->clear();
+}
+
+void DoorScopeEtl::onSaveLog()
+{
+	QSettings set;
+	const QString path = QFileDialog::getSaveFileName( this, tr("Save Log File"), 
+		set.value( "LogFile" ).toString(), "*.txt" ); 
+	if( path.isNull() )
+		return;
+	set.setValue( "LogFile", path );
+	if( !d_logModel->save( path ) )
+		QMessageBox::critical( this, tr("Save Log File"), tr("Cannot write to '%1'").arg( path ) );
+}
+
+void DoorScopeEtl::onShowLog( QAction* a )
+{
+	QSettings set;
+	set.setValue( "LogMinKind", a->data().toInt() );
+	d_logModel->setMinKind( a->data().toInt() );
 }
 
 void DoorScopeEtl::onLogTrace()
 {
 	QSettings set;
 	set.setValue( "LogTrace", d_logTrace->isChecked() );
+	StreamAgent::setTrace( d_logTrace->isChecked() );
 }
 
 void DoorScopeEtl::onLogProto()
@@ -212,6 +385,33 @@ void DoorScopeEtl::onLogProto()
 	}
 }
 
+void DoorScopeEtl::onChromeTrace()
+{
+	if( d_chromeTrace->isChecked() )
+	{
+		QSettings set;
+		const QString path = QFileDialog::getSaveFileName( this, tr("Save Chrome Trace File"), 
+			set.value( "TraceFile" ).toString(), "*.json" ); 
+		if( path.isNull() )
+		{
+			d_chromeTrace->setChecked( false );
+			return;
+		}
+		set.setValue( "TraceFile", path );
+		// Only every n-th command is recorded; 1 records all of them
+		if( !Tracer::start( path, set.value( "TraceSampling", 10 ).toInt() ) )
+		{
+			d_chromeTrace->setChecked( false );
+			onLog( "Cannot open trace file " + path, LogError );
+		}else
+			onLog( "Chrome trace started " + path, LogStatus );
+	}else
+	{
+		Tracer::stop();
+		onLog( "Chrome trace stopped", LogStatus );
+	}
+}
+
 void DoorScopeEtl::onAbout()
 {
 	QMessageBox::about( this, tr("About DoorScope ETL"), 
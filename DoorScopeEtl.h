@@ -21,7 +21,13 @@
 #include <QAction>
 
 class QTcpServer;
-class QTextEdit;
+class QLocalServer;
+class QIODevice;
+class IpcProtocol;
+class Supervisor;
+class QListView;
+class LogModel;
+class Dashboard;
 class HtmlImporter;
 
 class DoorScopeEtl : public QMainWindow
@@ -33,28 +39,46 @@ public:
 	~DoorScopeEtl();
 
 	enum LogKind { LogTrace = 0, LogStatus = 1, LogError = 2 };
+	// Multi-process mode, see Supervisor
+	void startWorkers( int count );
 public slots:
 	void onLog( QString, int kind );
 protected slots:
 	void onNewConnection();
+	void onNewLocalConnection();
 	void onSetPort();
+	void onSetLocalName();
+	void onLocalhostOnly();
 	void onClearLog();
+	void onSaveLog();
+	void onShowLog( QAction* );
 	void onLogTrace();
 	void onSetOutDir(); 
+	void onSetStagingDir(); 
 	void onData();
 	void onTest();
 	void onLogProto();
+	void onChromeTrace();
 	void onAbout();
 	void onParseHtml();
 protected:
 	void updatePort();
+	void updateLocalName();
+	void setupConnection( QIODevice*, IpcProtocol* );
 	// Overrides
 	void resizeEvent( QResizeEvent * event );
 private:
 	QTcpServer* d_server;
-	QTextEdit* d_log;
+	QLocalServer* d_local;
+	QAction* d_localhostOnly;
+	Supervisor* d_supervisor;
+	int d_workerCount;
+	QListView* d_log;
+	LogModel* d_logModel;
+	Dashboard* d_dashboard;
 	QAction* d_logTrace;
 	QAction* d_logProto;
+	QAction* d_chromeTrace;
 	QString d_logPath;
 	HtmlImporter* d_html;
 	QString d_lastPath;
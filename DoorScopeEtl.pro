@@ -37,17 +37,43 @@ win32 {
 	QMAKE_CXXFLAGS += -Wno-reorder -Wno-unused-parameter
  }
 
-HEADERS += ./DoorScopeEtl.h \
+HEADERS += ./ConnectionScheduler.h \
+	./Dashboard.h \
+	./DoorScopeEtl.h \
 	./HtmlImporter.h \
+	./HtmlTokenizer.h \
 	./IpcProtocol.h \
-	./StreamAgent.h
+	./LogModel.h \
+	./Metrics.h \
+	./OutputSink.h \
+	./Pipeline.h \
+	./Publisher.h \
+	./RichTextReader.h \
+	./ShardedServer.h \
+	./SpillBuffer.h \
+	./StreamAgent.h \
+	./StreamDictionary.h \
+	./Tracer.h
 
 #Source files
-SOURCES += ./DoorScopeEtl.cpp \
+SOURCES += ./ConnectionScheduler.cpp \
+	./Dashboard.cpp \
+	./DoorScopeEtl.cpp \
 	./HtmlImporter.cpp \
+	./HtmlTokenizer.cpp \
 	./IpcProtocol.cpp \
+	./LogModel.cpp \
 	./main.cpp \
-	./StreamAgent.cpp
+	./Metrics.cpp \
+	./OutputSink.cpp \
+	./Pipeline.cpp \
+	./Publisher.cpp \
+	./RichTextReader.cpp \
+	./ShardedServer.cpp \
+	./SpillBuffer.cpp \
+	./StreamAgent.cpp \
+	./StreamDictionary.cpp \
+	./Tracer.cpp
 
 
 #Include file(s)
@@ -0,0 +1,311 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QMap>
+#include <QHash>
+#include <QStringList>
+#include <Stream/DataReader.h>
+#include <Stream/Exceptions.h>
+#include "../StreamDictionary.h"
+#include <stdio.h>
+#include <string.h>
+
+// Validates .dsdx files written by DoorScopeEtl and prints what takes up space.
+// The file is memory mapped and the top level is read through MappedDevice, which
+// takes 64 bit offsets, so files of 2 GB and more work too; embedded Bml streams are
+// walked recursively on the cell the reader delivers.
+// Usage: DsdxCheck [-quiet] file.dsdx...
+// Exit code: 0 all files valid, 1 a file is malformed, 2 a file cannot be read
+
+struct Stats
+{
+	Stats():d_frames(0),d_objects(0),d_slots(0),d_embeds(0),d_images(0),d_imageBytes(0),
+		d_maxDepth(0),d_errors(0) {}
+	quint64 d_frames;
+	quint64 d_objects;
+	quint64 d_slots;
+	quint64 d_embeds;
+	quint64 d_images;
+	quint64 d_imageBytes;
+	int d_maxDepth; // frames and embeds together
+	int d_errors;
+	QMap<QByteArray,quint64> d_nameBytes; // approximate payload per attribute name
+	QMap<QByteArray,quint64> d_nameCount;
+	QMap<int,quint64> d_types;
+	QHash<QString,QByteArray> d_names; // interned slot names, converted once per name
+	StreamDictionary::Decoder d_dict; // top level only
+};
+
+// Read only view on the mapped file; unlike QByteArray::fromRawData the size is not limited to int
+class MappedDevice : public QIODevice
+{
+public:
+	MappedDevice( const uchar* data, qint64 size ):d_data(data),d_size(size) { open( QIODevice::ReadOnly ); }
+	bool isSequential() const { return false; }
+	qint64 size() const { return d_size; }
+protected:
+	qint64 readData( char* data, qint64 maxSize )
+	{
+		const qint64 n = qMin( maxSize, d_size - pos() );
+		if( n <= 0 )
+			return 0;
+		::memcpy( data, d_data + pos(), n );
+		return n;
+	}
+	qint64 writeData( const char*, qint64 ) { return -1; }
+private:
+	const uchar* d_data;
+	qint64 d_size;
+};
+
+static bool s_quiet = false;
+
+static void report( Stats& s, const QString& where, const QString& msg )
+{
+	s.d_errors++;
+	if( s.d_errors <= 20 )
+		fprintf( stderr, "%s: %s\n", where.toLocal8Bit().data(), msg.toLocal8Bit().data() );
+	else if( s.d_errors == 21 )
+		fprintf( stderr, "%s: further errors suppressed\n", where.toLocal8Bit().data() );
+}
+
+static quint64 payloadSize( const Stream::DataCell& v )
+{
+	switch( v.getType() )
+	{
+	case Stream::DataCell::TypeBml:
+	case Stream::DataCell::TypeImg:
+		return v.getArr().size();
+	case Stream::DataCell::TypeString:
+	case Stream::DataCell::TypeHtml:
+		return v.toString().size() * 2; // UTF-16 in the stream; toString shares the cell's string
+	default:
+		return 8;
+	}
+}
+
+// Types written by StreamAgent; anything else indicates a corrupt or foreign stream
+static bool isExpected( int type )
+{
+	switch( type )
+	{
+	case Stream::DataCell::TypeNull:
+	case Stream::DataCell::TypeTrue:
+	case Stream::DataCell::TypeFalse:
+	case Stream::DataCell::TypeUInt8:
+	case Stream::DataCell::TypeInt32:
+	case Stream::DataCell::TypeDouble:
+	case Stream::DataCell::TypeDateTime:
+	case Stream::DataCell::TypeString:
+	case Stream::DataCell::TypeHtml:
+	case Stream::DataCell::TypeImg:
+	case Stream::DataCell::TypeBml:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static QString location( const QString& path, const QByteArray& embed )
+{
+	return ( embed.isEmpty() ) ? path : path + " (embed " + QString::fromLatin1( embed ) + ")";
+}
+
+static const QByteArray& internName( Stats& s, const Stream::DataCell& name )
+{
+	const QString str = name.toString();
+	QHash<QString,QByteArray>::iterator i = s.d_names.find( str );
+	if( i == s.d_names.end() )
+		i = s.d_names.insert( str, str.toLatin1() );
+	return i.value();
+}
+
+// embed is the name of the Bml slot, empty on top level
+static void walk( Stream::DataReader& r, Stats& s, const QString& path, const QByteArray& embed, int depth )
+{
+	static const QString s_obj = "obj";
+	int level = 0;
+	Stream::DataReader::Token t = r.nextToken();
+	while( Stream::DataReader::isUseful( t ) )
+	{
+		switch( t )
+		{
+		case Stream::DataReader::BeginFrame:
+			level++;
+			s.d_frames++;
+			if( depth + level > s.d_maxDepth )
+				s.d_maxDepth = depth + level;
+			if( r.getName().toString() == s_obj )
+				s.d_objects++;
+			break;
+		case Stream::DataReader::EndFrame:
+			if( level == 0 )
+				report( s, location( path, embed ), "EndFrame without BeginFrame" );
+			else
+				level--;
+			break;
+		case Stream::DataReader::Slot:
+			{
+				s.d_slots++;
+				Stream::DataCell v = r.getValue();
+				QByteArray name = internName( s, r.getName() );
+				if( embed.isEmpty() )
+				{
+					const StreamDictionary::Decoder::Result res = s.d_dict.decode( name, v );
+					if( res == StreamDictionary::Decoder::Skip )
+						break;
+					if( res == StreamDictionary::Decoder::Error )
+					{
+						report( s, location( path, embed ), "dictionary: " + s.d_dict.getError() );
+						break;
+					}
+				}
+				const int type = v.getType();
+				if( !isExpected( type ) )
+				{
+					report( s, location( path, embed ), QString( "unexpected cell type %1" ).arg( type ) );
+					break;
+				}
+				s.d_types[type]++;
+				const quint64 bytes = payloadSize( v );
+				s.d_nameBytes[name] += bytes;
+				s.d_nameCount[name]++;
+				if( type == Stream::DataCell::TypeImg )
+				{
+					s.d_images++;
+					s.d_imageBytes += bytes;
+				}else if( type == Stream::DataCell::TypeBml )
+				{
+					s.d_embeds++;
+					Stream::DataReader sub( v.getArr() );
+					walk( sub, s, path, name, depth + level + 1 );
+				}
+			}
+			break;
+		default:
+			break;
+		}
+		t = r.nextToken();
+	}
+	if( t != Stream::DataReader::EndOfStream )
+		report( s, location( path, embed ), "protocol error in stream" );
+	if( level != 0 )
+		report( s, location( path, embed ), QString( "%1 frame(s) not closed" ).arg( level ) );
+}
+
+static QByteArray formatBytes( quint64 n )
+{
+	if( n >= 10 * 1024 * 1024 )
+		return QByteArray::number( n / ( 1024 * 1024 ) ) + " MB";
+	if( n >= 10 * 1024 )
+		return QByteArray::number( n / 1024 ) + " KB";
+	return QByteArray::number( n ) + " B";
+}
+
+static void print( const QString& path, qint64 size, const Stats& s )
+{
+	printf( "%s: %s, %s\n", path.toLocal8Bit().data(), formatBytes( size ).data(),
+		( s.d_errors == 0 ) ? "valid" : "MALFORMED" );
+	if( s_quiet )
+		return;
+	printf( "  objects %llu, frames %llu, slots %llu, embeds %llu, max depth %d\n",
+		(unsigned long long)s.d_objects, (unsigned long long)s.d_frames, (unsigned long long)s.d_slots,
+		(unsigned long long)s.d_embeds, s.d_maxDepth );
+	printf( "  images %llu, %s\n", (unsigned long long)s.d_images, formatBytes( s.d_imageBytes ).data() );
+	if( s.d_dict.isActive() )
+		printf( "  dictionary encoded: %d names, %d values\n", s.d_dict.getNameCount(), s.d_dict.getValueCount() );
+	printf( "  cell types:" );
+	QMap<int,quint64>::const_iterator t;
+	for( t = s.d_types.begin(); t != s.d_types.end(); ++t )
+	{
+		printf( " %s %llu", Stream::DataCell::typePrettyName[t.key()], (unsigned long long)t.value() );
+	}
+	printf( "\n  attribute                          count      bytes\n" );
+	// Largest first
+	QMultiMap<quint64,QByteArray> bySize;
+	QMap<QByteArray,quint64>::const_iterator i;
+	for( i = s.d_nameBytes.begin(); i != s.d_nameBytes.end(); ++i )
+		bySize.insert( i.value(), i.key() );
+	QMapIterator<quint64,QByteArray> j( bySize );
+	j.toBack();
+	while( j.hasPrevious() )
+	{
+		j.previous();
+		const QByteArray name = ( j.value().isEmpty() ) ? QByteArray( "(unnamed)" ) : j.value();
+		printf( "  %-30s %9llu %10s\n", name.data(), (unsigned long long)s.d_nameCount.value( j.value() ),
+			formatBytes( j.key() ).data() );
+	}
+}
+
+static int check( const QString& path )
+{
+	QFile f( path );
+	if( !f.open( QIODevice::ReadOnly ) )
+	{
+		fprintf( stderr, "%s: cannot open\n", path.toLocal8Bit().data() );
+		return 2;
+	}
+	const qint64 size = f.size();
+	uchar* map = ( size > 0 ) ? f.map( 0, size ) : 0;
+	if( map == 0 && size > 0 )
+	{
+		fprintf( stderr, "%s: cannot map\n", path.toLocal8Bit().data() );
+		return 2;
+	}
+	Stats s;
+	try
+	{
+		MappedDevice dev( map, size );
+		Stream::DataReader r( &dev );
+		walk( r, s, path, QByteArray(), 0 );
+	}catch( Stream::StreamException& e )
+	{
+		report( s, path, QString( "stream exception %1 %2" ).arg( e.getCode() ).arg( QString( e.getMsg() ) ) );
+	}catch( std::exception& e )
+	{
+		report( s, path, e.what() );
+	}
+	print( path, size, s );
+	if( map )
+		f.unmap( map );
+	return ( s.d_errors == 0 ) ? 0 : 1;
+}
+
+int main( int argc, char *argv[] )
+{
+	QCoreApplication a( argc, argv );
+
+	QStringList files;
+	const QStringList args = a.arguments();
+	for( int i = 1; i < args.size(); i++ )
+	{
+		if( args[i] == "-quiet" )
+			s_quiet = true;
+		else
+			files.append( args[i] );
+	}
+	if( files.isEmpty() )
+	{
+		fprintf( stderr, "usage: DsdxCheck [-quiet] file.dsdx...\n" );
+		return 2;
+	}
+	int res = 0;
+	for( int i = 0; i < files.size(); i++ )
+		res = qMax( res, check( files[i] ) );
+	return res;
+}
@@ -0,0 +1,29 @@
+
+TEMPLATE = app
+TARGET = DsdxCheck
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += .. ../.. ../../../Libraries
+
+	DESTDIR = ./tmp
+	OBJECTS_DIR = ./tmp
+	RCC_DIR = ./tmp
+	MOC_DIR = ./tmp
+
+win32 {
+	INCLUDEPATH += $$[QT_INSTALL_PREFIX]/include/Qt
+	DEFINES -= UNICODE
+ }else {
+	INCLUDEPATH += $$(HOME)/Programme/Qt-4.4.3/include/Qt
+	QMAKE_CXXFLAGS += -Wno-reorder -Wno-unused-parameter
+ }
+
+#Source files
+HEADERS += ../StreamDictionary.h
+
+SOURCES += ./DsdxCheck.cpp \
+	../StreamDictionary.cpp
+
+#Include file(s)
+include(../../Stream/Stream.pri)
@@ -23,6 +23,16 @@
 #include <QStack>
 #include <QFileInfo>
 #include <QDir>
+#include <QSettings>
+#include <QImage>
+#include <QTextCodec>
+#include <QtConcurrentMap>
+#include <QThreadPool>
+#include <QMutex>
+#include <QWaitCondition>
+#include "HtmlTokenizer.h"
+
+static const qint64 s_streamThreshold = 32 * 1024 * 1024;
 
 HtmlImporter::HtmlImporter(QObject *parent)
 	: QObject(parent)
@@ -44,32 +54,210 @@ struct Section
 	int d_level;
 };
 
+// Icons and bullets are referenced over and over with the same size; each (path, width, height)
+// is decoded and scaled only once and kept in a cache bounded by HtmlImageCache bytes (default
+// 64 MB), from which the least recently used images are dropped. The tree based import decodes
+// the distinct images up front in the global thread pool as far as they fit into the cache,
+// the streaming import and the rest on first use.
+struct ImageKey
+{
+	QString path;
+	int w, h;
+	ImageKey( const QString& p = QString(), int iw = 0, int ih = 0 ):path(p),w(iw),h(ih){}
+	bool operator<( const ImageKey& rhs ) const
+	{
+		if( w != rhs.w )
+			return w < rhs.w;
+		if( h != rhs.h )
+			return h < rhs.h;
+		return path < rhs.path;
+	}
+};
+
+struct ImageEntry
+{
+	QImage img;
+	qint64 bytes;
+	bool ok;
+	ImageEntry():bytes(0),ok(false){}
+};
+
+// Shared by the chapters written in parallel, see HtmlImporter::writeParallel
+class ImageCache
+{
+public:
+	ImageCache():d_bytes(0),d_tick(0)
+	{
+		QSettings set;
+		d_maxBytes = set.value( "HtmlImageCache", 64 * 1024 * 1024 ).toLongLong();
+	}
+	bool contains( const ImageKey& key )
+	{
+		QMutexLocker lock( &d_lock );
+		return d_slots.contains( key );
+	}
+	// Returns true and sets e if the image is cached. If another thread is decoding it, waits
+	// for that thread. Otherwise the key is marked in flight and false is returned; the caller
+	// then decodes the image and has to call insert.
+	bool acquire( const ImageKey& key, ImageEntry& e )
+	{
+		QMutexLocker lock( &d_lock );
+		forever
+		{
+			QMap<ImageKey,Slot>::iterator i = d_slots.find( key );
+			if( i != d_slots.end() )
+			{
+				i.value().used = ++d_tick;
+				e = i.value().entry;
+				return true;
+			}
+			if( !d_inFlight.contains( key ) )
+			{
+				d_inFlight.insert( key, true );
+				return false;
+			}
+			d_decoded.wait( &d_lock );
+		}
+	}
+	// Ends acquire; with evict false nothing is dropped and false is returned if the image
+	// doesn't fit. Images larger than the whole cache are never kept.
+	bool insert( const ImageKey& key, const ImageEntry& e, bool evict = true )
+	{
+		const qint64 bytes = e.img.numBytes();
+		QMutexLocker lock( &d_lock );
+		if( d_inFlight.remove( key ) )
+			d_decoded.wakeAll();
+		if( bytes > d_maxBytes || ( !evict && d_bytes + bytes > d_maxBytes ) )
+			return false;
+		if( d_slots.contains( key ) )
+			return true;
+		while( !d_slots.isEmpty() && d_bytes + bytes > d_maxBytes )
+		{
+			QMap<ImageKey,Slot>::iterator lru = d_slots.begin();
+			for( QMap<ImageKey,Slot>::iterator i = d_slots.begin(); i != d_slots.end(); ++i )
+				if( i.value().used < lru.value().used )
+					lru = i;
+			d_bytes -= lru.value().entry.img.numBytes();
+			d_slots.erase( lru );
+		}
+		Slot& s = d_slots[key];
+		s.entry = e;
+		s.used = ++d_tick;
+		d_bytes += bytes;
+		return true;
+	}
+private:
+	struct Slot
+	{
+		ImageEntry entry;
+		quint64 used;
+		Slot():used(0){}
+	};
+	QMap<ImageKey,Slot> d_slots;
+	QMap<ImageKey,bool> d_inFlight; // keys being decoded, see acquire
+	QMutex d_lock;
+	QWaitCondition d_decoded;
+	qint64 d_bytes; // decoded size of the cached images
+	qint64 d_maxBytes;
+	quint64 d_tick;
+};
+
+static ImageEntry decodeImage( const ImageKey& key )
+{
+	ImageEntry e;
+	e.bytes = QFileInfo( key.path ).size();
+	e.ok = e.img.load( key.path );
+	if( !e.ok )
+		e.img.load( ":/DoorScopeEtl/img_placeholder.png" );
+	else if( key.w > 0 && key.h > 0 )
+		e.img = e.img.scaled( QSize( key.w, key.h ), Qt::KeepAspectRatio, Qt::SmoothTransformation );
+	return e;
+}
+
+// Runs in the calling thread, which must not be the one writing to out
+static void decodeImages( StreamAgent* out, ImageCache& cache, const QList<ImageKey>& keys )
+{
+	QMap<ImageKey,bool> unique;
+	for( int i = 0; i < keys.size(); i++ )
+		if( !cache.contains( keys[i] ) )
+			unique[ keys[i] ] = true;
+	if( unique.isEmpty() )
+		return;
+	// In batches, so that not much more than the cache can hold is decoded at once
+	const QList<ImageKey> todo = unique.keys();
+	const int batch = qMax( 1, QThreadPool::globalInstance()->maxThreadCount() ) * 4;
+	const quint64 start = Metrics::now();
+	int done = 0;
+	bool full = false;
+	for( int i = 0; i < todo.size() && !full; i += batch )
+	{
+		const QList<ImageKey> part = todo.mid( i, batch );
+		const QList<ImageEntry> res = QtConcurrent::blockingMapped< QList<ImageEntry> >( part, decodeImage );
+		for( int j = 0; j < part.size(); j++ )
+		{
+			if( cache.insert( part[j], res[j], false ) )
+				done++;
+			else
+				full = true; // the others are decoded on first use
+		}
+	}
+	out->d_metrics.addTime( Metrics::Image, start );
+	out->onTrace( QString( "Decoded %1 unique of %2 images up front" ).arg( done ).arg( keys.size() ) );
+}
+
+static void writeImage( StreamAgent* out, ImageCache& cache, const ImageKey& key )
+{
+	ImageEntry e;
+	if( !cache.acquire( key, e ) )
+	{
+		const quint64 start = Metrics::now();
+		e = decodeImage( key );
+		cache.insert( key, e );
+		out->d_metrics.addTime( Metrics::Image, start );
+	}
+	out->d_metrics.d_imageBytes += e.bytes;
+	out->writeImg( e.img, "ole" );
+	if( !e.ok )
+		out->onError( "HtmlImporter: cannot load image file " + key.path );
+}
+
 struct Context
 {
-	Context():nextId(1){}
+	Context( const QTextHtmlParser& p, ImageCache* i ):nextId(1),out(0),parser(p),images(i){}
 	QStack<int> trace; // Level
 	quint32 nextId;
 	StreamAgent* out;
 	QDir path;
-	QTextHtmlParser parser;
+	const QTextHtmlParser& parser; // shared by the sections, read only
+	ImageCache* images; // dito
 };
 
+static inline void stdAtts( StreamAgent* out )
+{
+	out->writeString( "DoorScope", "Created By" );
+	out->writeDate( QDateTime::currentDateTime(), "Created On" );
+	out->writeString( "HTML Import", "Created Thru" );
+}
+
 static inline void stdAtts( Context& ctx )
 {
-	ctx.out->writeString( "DoorScope", "Created By" );
-	ctx.out->writeDate( QDateTime::currentDateTime(), "Created On" );
-	ctx.out->writeString( "HTML Import", "Created Thru" );
+	stdAtts( ctx.out );
 }
 
-static void readImg( Context& ctx, const QTextHtmlParserNode& n )
+static QString imgPath( const QDir& dir, const QString& imageName )
 {
-	// NOTE n.imageName ist noch kodiert und enthlt z.B. %20
-	const QUrl url = QUrl::fromEncoded( n.imageName.toUtf8() );
+	// NOTE imageName ist noch kodiert und enthlt z.B. %20
+	const QUrl url = QUrl::fromEncoded( imageName.toUtf8() );
 	QFileInfo path( url.toLocalFile() );
 	if( path.isRelative() )
-		path = ctx.path.absoluteFilePath( url.toLocalFile() );
+		path = dir.absoluteFilePath( url.toLocalFile() );
+	return path.absoluteFilePath();
+}
+
+static void readImg( Context& ctx, const QTextHtmlParserNode& n )
+{
 	ctx.out->startFrame( "rt" );
-	ctx.out->readImg( path.absoluteFilePath(), n.imageWidth, n.imageHeight, "ole" );
+	writeImage( ctx.out, *ctx.images, ImageKey( imgPath( ctx.path, n.imageName ), n.imageWidth, n.imageHeight ) );
 	/*
 	if( n.imageWidth > 0.0 && n.imageHeight > 0.0 )
 	{
@@ -115,22 +303,27 @@ static int f2i( QTextHTMLElements f )
 	return -1;
 }
 
-static void writeFormat( Context& ctx, const std::bitset<8>& format )
+static void writeFormat( StreamAgent* out, const std::bitset<8>& format )
 {
 	if( format.test( HtmlImporter::Italic ) )
-		ctx.out->writeChar( 'i' );
+		out->writeChar( 'i' );
 	if( format.test( HtmlImporter::Bold ) )
-		ctx.out->writeChar( 'b' );
+		out->writeChar( 'b' );
 	if( format.test( HtmlImporter::Underline ) )
-		ctx.out->writeChar( 'u' );
+		out->writeChar( 'u' );
 	if( format.test( HtmlImporter::Strikeout ) )
-		ctx.out->writeChar( 'k' );
+		out->writeChar( 'k' );
 	if( format.test( HtmlImporter::Super ) )
-		ctx.out->writeChar( 'p' );
+		out->writeChar( 'p' );
 	if( format.test( HtmlImporter::Sub ) )
-		ctx.out->writeChar( 's' );
+		out->writeChar( 's' );
 	if( format.test( HtmlImporter::Fixed ) )
-		ctx.out->writeChar( 'f' ); // RISK: neu gegenber Doors
+		out->writeChar( 'f' ); // RISK: neu gegenber Doors
+}
+
+static inline void writeFormat( Context& ctx, const std::bitset<8>& format )
+{
+	writeFormat( ctx.out, format );
 }
 
 static QString simplify( QString str )
@@ -398,8 +591,53 @@ static int findNumber( const QString& title )
 	return -1;
 }
 
-static void readHtmlNode( Context& ctx, const QTextHtmlParserNode& p )
+static void writeHeading( StreamAgent* out, QStack<int>& trace, quint32& nextId, int l, const QString& str )
 {
+	// Headings open an obj which stays open for the following content up to the next
+	// heading of the same or a higher level
+	while( l <= trace.top() && trace.size() > 1 )
+	{
+		trace.pop();
+		out->endFrame(); // obj
+	}
+	out->startFrame( "obj" );
+	stdAtts( out );
+	out->writeInt( nextId++, "Absolute Number" );
+	const int split = findNumber( str );
+	if( split != -1 )
+	{
+		out->writeString( str.left( split ), "~number" );
+		out->writeString( str.mid( split ), "Object Heading" );
+	}else
+		out->writeString( str, "Object Heading" );
+	trace.push( l );
+}
+
+// A node which writes an obj; whether it writes anything at all is decided up front
+// so that the ids are known before the sections are written
+struct Unit
+{
+	int d_node;
+	QString d_heading; // only for headings
+	Unit( int n = -1, const QString& h = QString() ):d_node(n),d_heading(h){}
+};
+
+// The units from one h1 or h2 heading up to the next one; besides the ids and the
+// headings still open at its start a chapter doesn't depend on the others.
+struct Chapter
+{
+	QList<Unit> d_units;
+	QStack<int> d_trace; // heading levels open at the start
+	quint32 d_firstId;
+	Context* d_ctx; // only while written in parallel
+	StreamAgent* d_out; // dito, records the chapter
+	Chapter():d_firstId(1),d_ctx(0),d_out(0){}
+};
+
+static void readHtmlNode( const QTextHtmlParser& parser, int n, QList<Chapter>& chapters,
+	QStack<int>& trace, quint32& nextId )
+{
+	const QTextHtmlParserNode& p = parser.at( n );
 	switch( p.id )
 	{
 	case Html_html:
@@ -408,19 +646,15 @@ static void readHtmlNode( Context& ctx, const QTextHtmlParserNode& p )
 	case Html_span:
 	default:
 		for( int i = 0; i < p.children.count(); i++ )
-			readHtmlNode( ctx, ctx.parser.at( p.children[i] ) );
+			readHtmlNode( parser, p.children[i], chapters, trace, nextId );
 		break;
 	case Html_p:
 	case Html_address:
 	case Html_a:
-		if( !collectText( ctx.parser, p ).isEmpty() ) // RISK: teuer
+		if( !collectText( parser, p ).isEmpty() ) // RISK: teuer
 		{
-			ctx.out->startFrame( "obj" );
-			ctx.out->writeInt( ctx.nextId++, "Absolute Number" );
-			stdAtts( ctx );
-
-			readParagraph( ctx, p );
-			ctx.out->endFrame(); // obj
+			chapters.last().d_units.append( Unit( n ) );
+			nextId++;
 		}
 		break;
 	// case Html_center: // gibt es nicht
@@ -429,13 +663,8 @@ static void readHtmlNode( Context& ctx, const QTextHtmlParserNode& p )
 	case Html_table:
 	case Html_dl:
     case Html_pre: 
-		{
-			ctx.out->startFrame( "obj" );
-			ctx.out->writeInt( ctx.nextId++, "Absolute Number" );
-			stdAtts( ctx );
-			ctx.out->writeHtml( generateHtml( ctx, p ), "Object Text" );
-			ctx.out->endFrame(); // obj
-		}
+		chapters.last().d_units.append( Unit( n ) );
+		nextId++;
 		break;
 
 	case Html_h1:
@@ -445,26 +674,22 @@ static void readHtmlNode( Context& ctx, const QTextHtmlParserNode& p )
 	case Html_h5:
 	case Html_h6:
 		{
-			const QString str = simplify( collectText( ctx.parser, p ) ); // ignoriere Formatierung
+			const QString str = simplify( collectText( parser, p ) ); // ignoriere Formatierung
 			if( !str.isEmpty() )
 			{
 				const int l = h2i( p.id );
-				while( l <= ctx.trace.top() && ctx.trace.size() > 1 )
+				if( l <= 2 && !chapters.last().d_units.isEmpty() )
 				{
-					ctx.trace.pop();
-					ctx.out->endFrame(); // obj
+					chapters.append( Chapter() );
+					chapters.last().d_trace = trace;
+					chapters.last().d_firstId = nextId;
 				}
-				ctx.out->startFrame( "obj" );
-				stdAtts( ctx );
-				ctx.out->writeInt( ctx.nextId++, "Absolute Number" );
-				const int split = findNumber( str );
-				if( split != -1 )
-				{
-					ctx.out->writeString( str.left( split ), "~number" );
-					ctx.out->writeString( str.mid( split ), "Object Heading" );
-				}else
-					ctx.out->writeString( str, "Object Heading" );
-				ctx.trace.push( l );
+				chapters.last().d_units.append( Unit( n, str ) );
+				nextId++;
+				// same as writeHeading
+				while( l <= trace.top() && trace.size() > 1 )
+					trace.pop();
+				trace.push( l );
 			}
 		}
 		break;
@@ -488,6 +713,59 @@ static void readHtmlNode( Context& ctx, const QTextHtmlParserNode& p )
 	}
 }
 
+static void writeUnit( Context& ctx, const Unit& u )
+{
+	const QTextHtmlParserNode& p = ctx.parser.at( u.d_node );
+	switch( p.id )
+	{
+	case Html_p:
+	case Html_address:
+	case Html_a:
+		ctx.out->startFrame( "obj" );
+		ctx.out->writeInt( ctx.nextId++, "Absolute Number" );
+		stdAtts( ctx );
+
+		readParagraph( ctx, p );
+		ctx.out->endFrame(); // obj
+		break;
+	case Html_h1:
+	case Html_h2:
+	case Html_h3:
+	case Html_h4:
+	case Html_h5:
+	case Html_h6:
+		writeHeading( ctx.out, ctx.trace, ctx.nextId, h2i( p.id ), u.d_heading );
+		break;
+	default:
+		ctx.out->startFrame( "obj" );
+		ctx.out->writeInt( ctx.nextId++, "Absolute Number" );
+		stdAtts( ctx );
+		ctx.out->writeHtml( generateHtml( ctx, p ), "Object Text" );
+		ctx.out->endFrame(); // obj
+		break;
+	}
+}
+
+static void writeChapter( Context& ctx, const Chapter& c )
+{
+	ctx.trace = c.d_trace;
+	ctx.nextId = c.d_firstId;
+	for( int i = 0; i < c.d_units.size(); i++ )
+		writeUnit( ctx, c.d_units[i] );
+}
+
+static void writeChapterTask( Chapter& c )
+{
+	// Runs in a pool thread with its own Context and recording StreamAgent
+	try
+	{
+		writeChapter( *c.d_ctx, c );
+	}catch( std::exception& e )
+	{
+		c.d_out->onError( "HtmlImporter: " + QString( e.what() ) );
+	}
+}
+
 static void structure( Context& ctx, const QTextHtmlParserNode& p, Section* parent )
 {
 	switch( p.id )
@@ -525,10 +803,394 @@ static void findName( Context& ctx, const QString& name )
 	ctx.out->writeString( name, "Name" );
 }
 
+//////////////////////////////////////////////////////////////////////////////////
+// Streaming import for large files; see HtmlTokenizer. Produces the same objects as
+// the tree based import above, but only keeps the current block in memory.
+
+struct StreamContext
+{
+	StreamContext():nextId(1),nameWritten(false),reuse(false){}
+	HtmlTokenizer tok;
+	QStack<int> trace; // Level
+	quint32 nextId;
+	StreamAgent* out;
+	QDir path;
+	QString name;
+	bool nameWritten;
+	bool reuse; // the current token ended a block and has to be read again
+	ImageCache images;
+};
+
+struct Run
+{
+	enum Kind { Text, Image, Break };
+	Kind kind;
+	std::bitset<8> format;
+	QString text; // or image source
+	int w, h;
+	Run( Kind k, const std::bitset<8>& f, const QString& t = QString(), int iw = 0, int ih = 0 ):
+		kind(k),format(f),text(t),w(iw),h(ih){}
+};
+
+static inline HtmlTokenizer::TokenType nextToken( StreamContext& ctx )
+{
+	if( ctx.reuse )
+	{
+		ctx.reuse = false;
+		return ctx.tok.getType();
+	}
+	return ctx.tok.next();
+}
+
+static int headingLevel( const QByteArray& tag )
+{
+	if( tag.size() == 2 && tag[0] == 'h' && tag[1] >= '1' && tag[1] <= '6' )
+		return tag[1] - '0';
+	return 0;
+}
+
+static inline bool isParagraph( const QByteArray& tag )
+{
+	return tag == "p" || tag == "address" || tag == "a";
+}
+
+static inline bool isHtmlBlock( const QByteArray& tag )
+{
+	return tag == "ul" || tag == "ol" || tag == "table" || tag == "dl" || tag == "pre";
+}
+
+// Tags which implicitly close an open paragraph or heading
+static bool isBoundary( const QByteArray& tag )
+{
+	return headingLevel( tag ) != 0 || isHtmlBlock( tag ) || tag == "p" || tag == "address" ||
+		tag == "div" || tag == "body" || tag == "html" || tag == "li" || tag == "tr" ||
+		tag == "td" || tag == "th" || tag == "dt" || tag == "dd" || tag == "blockquote" ||
+		tag == "center" || tag == "hr";
+}
+
+static inline bool isVoid( const QByteArray& tag )
+{
+	return tag == "br" || tag == "img" || tag == "hr" || tag == "col" || tag == "input" ||
+		tag == "meta" || tag == "link" || tag == "area" || tag == "base" || tag == "wbr";
+}
+
+static int formatIndex( const QByteArray& tag )
+{
+	// Wie f2i
+	if( tag == "em" || tag == "i" || tag == "cite" || tag == "var" || tag == "dfn" )
+		return HtmlImporter::Italic;
+	if( tag == "strong" || tag == "b" )
+		return HtmlImporter::Bold;
+	if( tag == "u" )
+		return HtmlImporter::Underline;
+	if( tag == "s" || tag == "strike" )
+		return HtmlImporter::Strikeout;
+	if( tag == "code" || tag == "tt" || tag == "kbd" || tag == "samp" )
+		return HtmlImporter::Fixed;
+	if( tag == "sub" )
+		return HtmlImporter::Sub;
+	if( tag == "sup" )
+		return HtmlImporter::Super;
+	return -1;
+}
+
+static void ensureName( StreamContext& ctx, const QString& title = QString() )
+{
+	if( ctx.nameWritten )
+		return;
+	ctx.out->writeString( ( title.isEmpty() ) ? ctx.name : title, "Name" );
+	ctx.nameWritten = true;
+}
+
+static void streamTitle( StreamContext& ctx )
+{
+	QString text;
+	while( nextToken( ctx ) != HtmlTokenizer::Eof )
+	{
+		if( ctx.tok.getType() == HtmlTokenizer::Text )
+			text += ctx.tok.getText();
+		else if( ctx.tok.getType() == HtmlTokenizer::EndTag && ctx.tok.getTag() == "title" )
+			break;
+	}
+	const QString str = simplify( text );
+	if( !str.isEmpty() )
+		ensureName( ctx, str );
+}
+
+static void streamHeading( StreamContext& ctx, const QByteArray& tag )
+{
+	QString text;
+	while( nextToken( ctx ) != HtmlTokenizer::Eof )
+	{
+		const HtmlTokenizer::TokenType t = ctx.tok.getType();
+		if( t == HtmlTokenizer::Text )
+			text += ctx.tok.getText();
+		else if( t == HtmlTokenizer::StartTag && ctx.tok.getTag() == "img" )
+			text += "<img>";
+		else if( t == HtmlTokenizer::EndTag && ctx.tok.getTag() == tag )
+			break;
+		else if( t == HtmlTokenizer::StartTag && isBoundary( ctx.tok.getTag() ) )
+		{
+			ctx.reuse = true;
+			break;
+		}
+	}
+	const QString str = simplify( text ); // ignoriere Formatierung
+	if( !str.isEmpty() )
+		writeHeading( ctx.out, ctx.trace, ctx.nextId, headingLevel( tag ), str );
+}
+
+static void streamParagraph( StreamContext& ctx, const QByteArray& tag )
+{
+	QList<Run> runs;
+	QList< QPair<QByteArray,int> > open; // tag, format index
+	std::bitset<8> format;
+	bool hasContent = false;
+	while( nextToken( ctx ) != HtmlTokenizer::Eof )
+	{
+		const HtmlTokenizer::TokenType t = ctx.tok.getType();
+		const QByteArray& sub = ctx.tok.getTag();
+		if( t == HtmlTokenizer::Text )
+		{
+			const QString str = simplify( ctx.tok.getText() );
+			if( !str.isEmpty() )
+			{
+				runs.append( Run( Run::Text, format, str ) );
+				if( !str.trimmed().isEmpty() )
+					hasContent = true;
+			}
+		}else if( t == HtmlTokenizer::StartTag )
+		{
+			if( sub == "img" )
+			{
+				runs.append( Run( Run::Image, format, ctx.tok.getAttribute( "src" ),
+					ctx.tok.getAttribute( "width" ).toInt(), ctx.tok.getAttribute( "height" ).toInt() ) );
+				hasContent = true;
+			}else if( sub == "br" )
+				runs.append( Run( Run::Break, format ) );
+			else if( isBoundary( sub ) || sub == tag )
+			{
+				ctx.reuse = true;
+				break;
+			}else if( !isVoid( sub ) && !ctx.tok.isSelfClosing() )
+			{
+				const int fidx = formatIndex( sub );
+				open.append( qMakePair( sub, fidx ) );
+				if( fidx != -1 )
+					format.set( fidx );
+			}
+		}else if( t == HtmlTokenizer::EndTag )
+		{
+			if( sub == tag || isBoundary( sub ) )
+				break;
+			int i = open.size() - 1;
+			while( i >= 0 && open[i].first != sub )
+				i--;
+			if( i >= 0 )
+			{
+				// Setzte Format sofort zurck, sobald Scope des Formats endet
+				while( open.size() > i )
+					open.removeLast();
+				format.reset();
+				for( int j = 0; j < open.size(); j++ )
+					if( open[j].second != -1 )
+						format.set( open[j].second );
+			}
+		}
+	}
+	if( !hasContent )
+		return;
+
+	ctx.out->startFrame( "obj" );
+	ctx.out->writeInt( ctx.nextId++, "Absolute Number" );
+	stdAtts( ctx.out );
+	ctx.out->startEmbed();
+	ctx.out->startFrame( "par" );
+	for( int i = 0; i < runs.size(); i++ )
+	{
+		const Run& r = runs[i];
+		if( r.kind == Run::Image )
+		{
+			// same as readImg of the tree based import
+			ctx.out->startFrame( "rt" );
+			writeImage( ctx.out, ctx.images, ImageKey( imgPath( ctx.path, r.text ), r.w, r.h ) );
+			ctx.out->endFrame(); // rt
+			continue;
+		}
+		ctx.out->startFrame( "rt" );
+		writeFormat( ctx.out, r.format );
+		ctx.out->writeString( ( r.kind == Run::Break ) ? QString( "\n" ) : r.text );
+		ctx.out->endFrame(); // rt
+	}
+	ctx.out->endFrame(); // par
+	ctx.out->endEmbed( "Object Text" );
+	ctx.out->endFrame(); // obj
+}
+
+static void streamHtmlBlock( StreamContext& ctx, const QByteArray& tag )
+{
+	// Wie generateHtml
+	const QStringList blocked = QStringList() << "width" << "height" << "lang" << "class" << "size" << 
+		"style" << "align" << "valign";
+
+	QString html;
+	int depth = 0;
+	do
+	{
+		const HtmlTokenizer::TokenType t = ctx.tok.getType();
+		const QByteArray& sub = ctx.tok.getTag();
+		if( t == HtmlTokenizer::Text )
+			html += coded( ctx.tok.getText() );
+		else if( t == HtmlTokenizer::StartTag && sub != "font" )
+		{
+			if( sub == tag )
+				depth++;
+			html += QString( "<%1" ).arg( QString::fromLatin1( sub ) );
+			const QList<HtmlTokenizer::Attribute>& atts = ctx.tok.getAttributes();
+			for( int i = 0; i < atts.size(); i++ )
+			{
+				const QString name = QString::fromLatin1( atts[i].first );
+				if( !blocked.contains( name ) )
+					html += QString( " %1=\"%2\"" ).arg( name ).arg( coded( atts[i].second ).replace( QChar('"'), "&quot;" ) );
+			}
+			html += ">";
+		}else if( t == HtmlTokenizer::EndTag && sub != "font" && !isVoid( sub ) )
+		{
+			html += QString( "</%1>" ).arg( QString::fromLatin1( sub ) );
+			if( sub == tag && --depth == 0 )
+				break;
+		}
+	}while( nextToken( ctx ) != HtmlTokenizer::Eof );
+
+	ctx.out->startFrame( "obj" );
+	ctx.out->writeInt( ctx.nextId++, "Absolute Number" );
+	stdAtts( ctx.out );
+	ctx.out->writeHtml( html, "Object Text" );
+	ctx.out->endFrame(); // obj
+}
+
+static void streamDocument( StreamContext& ctx )
+{
+	while( nextToken( ctx ) != HtmlTokenizer::Eof )
+	{
+		if( ctx.tok.getType() != HtmlTokenizer::StartTag )
+			continue; // Text ausserhalb von Blcken wird wie beim Baum ignoriert
+		const QByteArray tag = ctx.tok.getTag();
+		if( tag == "title" )
+			streamTitle( ctx );
+		else if( headingLevel( tag ) != 0 )
+		{
+			ensureName( ctx );
+			streamHeading( ctx, tag );
+		}else if( isParagraph( tag ) )
+		{
+			ensureName( ctx );
+			streamParagraph( ctx, tag );
+		}else if( isHtmlBlock( tag ) )
+		{
+			ensureName( ctx );
+			streamHtmlBlock( ctx, tag );
+		}else if( tag == "body" )
+			ensureName( ctx );
+	}
+	ensureName( ctx );
+}
+
+bool HtmlImporter::parseStream( const QString& path )
+{
+	d_error.clear();
+
+	StreamContext ctx;
+	if( !ctx.tok.open( path ) )
+	{
+		d_error = ctx.tok.getError();
+		return false;
+	}
+	ctx.out = &d_out;
+	QFileInfo info( path );
+	ctx.path = info.absoluteDir();
+	ctx.name = info.completeBaseName();
+	d_out.onStatus( QString( "Streaming import of %1 (charset %2)" ).arg( path ).
+		arg( QString::fromLatin1( ctx.tok.getCharset() ) ) );
+
+	try
+	{
+		d_out.open( ctx.name );
+		d_out.writeString( "DoorScopeExport" );
+		d_out.writeString( "0.3" );
+		d_out.writeDate( QDateTime::currentDateTime() );
+		d_out.startFrame( "mod" );
+
+		d_out.writeString( QUuid::createUuid().toString(), "~moduleID" );
+		stdAtts( &d_out );
+		d_out.writeString( ctx.name, "~modulePath" );
+
+		ctx.trace.push( 0 );
+		streamDocument( ctx );
+
+		for( int j = 1; j < ctx.trace.size(); j++ )
+			ctx.out->endFrame(); // obj
+
+		d_out.endFrame(); // mod
+	}catch( std::exception& e )
+	{
+		d_error += e.what();
+		d_out.close();
+		return false;
+	}
+	d_out.close();
+	return true;
+}
+
+void HtmlImporter::writeParallel( Context& ctx, QList<Chapter>& chapters )
+{
+	// Each chapter is written into its own recording agent in the global thread pool;
+	// the recordings are then appended to d_out in document order. The whole document
+	// is held in memory anyway, the recordings add about the size of the output.
+	for( int i = 0; i < chapters.size(); i++ )
+	{
+		Chapter& c = chapters[i];
+		c.d_out = new StreamAgent();
+		connect( c.d_out, SIGNAL( log( QString, int ) ), &d_out, SIGNAL( log( QString, int ) ) );
+		c.d_out->record( d_out.getName() );
+		c.d_ctx = new Context( ctx.parser, ctx.images );
+		c.d_ctx->out = c.d_out;
+		c.d_ctx->path = ctx.path;
+	}
+	const quint64 start = Metrics::now();
+	QtConcurrent::blockingMap( chapters, writeChapterTask );
+	d_out.onStatus( QString( "Wrote %1 chapters in parallel in %2 ms" ).arg( chapters.size() ).
+		arg( ( Metrics::now() - start ) / 1000000 ) );
+	for( int i = 0; i < chapters.size(); i++ )
+	{
+		Chapter& c = chapters[i];
+		d_out.replay( *c.d_out );
+		delete c.d_ctx;
+		c.d_ctx = 0;
+		delete c.d_out;
+		c.d_out = 0;
+	}
+}
+
 bool HtmlImporter::parse( const QString& path )
 {
 	d_error.clear();
 
+	// Large files are imported in streaming mode; QTextHtmlParser needs several times the file
+	// size in memory. A negative threshold disables streaming.
+	QSettings set;
+	const qint64 threshold = set.value( "HtmlStreamThreshold", s_streamThreshold ).toLongLong();
+	if( threshold >= 0 && QFileInfo( path ).size() >= threshold )
+	{
+		HtmlTokenizer probe;
+		if( probe.open( path ) )
+		{
+			probe.close();
+			return parseStream( path );
+		}
+		d_out.onStatus( probe.getError() + "; falling back to the tree based import" );
+	}
+
 	QFile f( path );
 	if( !f.open( QIODevice::ReadOnly ) )
 	{
@@ -536,16 +1198,29 @@ bool HtmlImporter::parse( const QString& path )
 		return false;
 	}
 
-	Context ctx;
+	const QByteArray bytes = f.readAll();
+	int bom;
+	QTextCodec* codec = HtmlTokenizer::detectCodec( bytes.constData(), bytes.size(), &bom );
+	QTextHtmlParser parser;
+	parser.parse( codec->toUnicode( bytes.constData() + bom, bytes.size() - bom ), 0 );
+	ImageCache images;
+	Context ctx( parser, &images );
 	ctx.out = &d_out;
 	QFileInfo info( path );
 	ctx.path = info.absoluteDir();
-	ctx.parser.parse( QString::fromLatin1( f.readAll() ), 0 );
 	if( ctx.parser.count() == 0 )
 	{
 		d_error = "HTML stream has no contents!";
 		return false;
 	}
+	QList<ImageKey> refs;
+	for( int i = 0; i < ctx.parser.count(); i++ )
+	{
+		const QTextHtmlParserNode& img = ctx.parser.at(i);
+		if( img.id == Html_img )
+			refs.append( ImageKey( imgPath( ctx.path, img.imageName ), img.imageWidth, img.imageHeight ) );
+	}
+	decodeImages( &d_out, images, refs );
 	//Section root;
 	//structure( ctx, ctx.parser.at(0), &root );
 
@@ -563,11 +1238,21 @@ bool HtmlImporter::parse( const QString& path )
 		d_out.writeString( name, "~modulePath" );
 		findName( ctx, name );
 
-		const QTextHtmlParserNode& n = ctx.parser.at(0);
-		ctx.trace.push( 0 );
-		readHtmlNode( ctx, n );
+		QList<Chapter> chapters;
+		chapters.append( Chapter() );
+		chapters.last().d_trace.push( 0 );
+		QStack<int> trace = chapters.last().d_trace;
+		quint32 nextId = 1;
+		readHtmlNode( ctx.parser, 0, chapters, trace, nextId );
 
-		for( int j = 1; j < ctx.trace.size(); j++ )
+		if( chapters.size() > 1 && QThreadPool::globalInstance()->maxThreadCount() > 1 &&
+			set.value( "HtmlParallelChapters", true ).toBool() )
+			writeParallel( ctx, chapters );
+		else
+			for( int i = 0; i < chapters.size(); i++ )
+				writeChapter( ctx, chapters[i] );
+
+		for( int j = 1; j < trace.size(); j++ )
 			ctx.out->endFrame(); // obj
 
 		d_out.endFrame(); // mod
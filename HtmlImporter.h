@@ -22,6 +22,9 @@
 #include <QList>
 #include "StreamAgent.h"
 
+struct Context;
+struct Chapter;
+
 class HtmlImporter : public QObject
 {
 public:
@@ -33,6 +36,8 @@ public:
 	const QString& getError() const { return d_error; }
 	const QString& getInfo() const { return d_info; }
 private:
+	bool parseStream( const QString& path );
+	void writeParallel( Context&, QList<Chapter>& );
 	QString d_error;
 	QString d_info;
 	StreamAgent d_out;
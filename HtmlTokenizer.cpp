@@ -0,0 +1,391 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "HtmlTokenizer.h"
+#include <QTextCodec>
+#include <QHash>
+
+static inline bool isSpace( char c )
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+static inline bool isAlpha( char c )
+{
+	return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' );
+}
+
+static inline char toLower( char c )
+{
+	return ( c >= 'A' && c <= 'Z' ) ? c - 'A' + 'a' : c;
+}
+
+struct Entity
+{
+	const char* name;
+	ushort code;
+};
+// Only the entities which occur in practice; unknown entities are left as is.
+static const Entity s_entities[] =
+{
+	{ "amp", 38 }, { "lt", 60 }, { "gt", 62 }, { "quot", 34 }, { "apos", 39 }, { "nbsp", 160 },
+	{ "iexcl", 161 }, { "cent", 162 }, { "pound", 163 }, { "yen", 165 }, { "sect", 167 }, 
+	{ "uml", 168 }, { "copy", 169 }, { "laquo", 171 }, { "not", 172 }, { "shy", 173 }, { "reg", 174 }, 
+	{ "deg", 176 }, { "plusmn", 177 }, { "sup2", 178 }, { "sup3", 179 }, { "acute", 180 }, { "micro", 181 }, 
+	{ "para", 182 }, { "middot", 183 }, { "sup1", 185 }, { "raquo", 187 }, { "frac14", 188 }, 
+	{ "frac12", 189 }, { "frac34", 190 }, { "iquest", 191 }, { "Agrave", 192 }, { "Aacute", 193 }, 
+	{ "Acirc", 194 }, { "Auml", 196 }, { "Aring", 197 }, { "Ccedil", 199 }, { "Egrave", 200 }, 
+	{ "Eacute", 201 }, { "Ecirc", 202 }, { "Ouml", 214 }, { "times", 215 }, { "Uuml", 220 }, 
+	{ "szlig", 223 }, { "agrave", 224 }, { "aacute", 225 }, { "acirc", 226 }, { "auml", 228 }, 
+	{ "aring", 229 }, { "ccedil", 231 }, { "egrave", 232 }, { "eacute", 233 }, { "ecirc", 234 }, 
+	{ "euml", 235 }, { "igrave", 236 }, { "iacute", 237 }, { "icirc", 238 }, { "iuml", 239 }, 
+	{ "ntilde", 241 }, { "ograve", 242 }, { "oacute", 243 }, { "ocirc", 244 }, { "ouml", 246 }, 
+	{ "divide", 247 }, { "ugrave", 249 }, { "uacute", 250 }, { "ucirc", 251 }, { "uuml", 252 }, 
+	{ "yuml", 255 }, { "ndash", 8211 }, { "mdash", 8212 }, { "lsquo", 8216 }, { "rsquo", 8217 }, 
+	{ "sbquo", 8218 }, { "ldquo", 8220 }, { "rdquo", 8221 }, { "bdquo", 8222 }, { "dagger", 8224 }, 
+	{ "bull", 8226 }, { "hellip", 8230 }, { "permil", 8240 }, { "lsaquo", 8249 }, { "rsaquo", 8250 }, 
+	{ "euro", 8364 }, { "trade", 8482 }, { "larr", 8592 }, { "rarr", 8594 }, { "le", 8804 }, 
+	{ "ge", 8805 }, { "ne", 8800 }, { "alpha", 945 }, { "beta", 946 }, { "gamma", 947 }, 
+	{ "delta", 948 }, { "mu", 956 }, { "pi", 960 }, { "sigma", 963 }, { "Omega", 937 }, 
+	{ 0, 0 }
+};
+
+HtmlTokenizer::HtmlTokenizer()
+	: d_data( 0 ), d_size( 0 ), d_pos( 0 ), d_codec( 0 ), d_type( Eof ), d_selfClosing( false )
+{
+}
+
+HtmlTokenizer::~HtmlTokenizer()
+{
+	close();
+}
+
+bool HtmlTokenizer::open( const QString& path )
+{
+	close();
+	d_error.clear();
+	d_file.setFileName( path );
+	if( !d_file.open( QIODevice::ReadOnly ) )
+	{
+		d_error = QString( "cannot open '%1' for reading" ).arg( path );
+		return false;
+	}
+	d_size = d_file.size();
+	if( d_size > 0 )
+	{
+		d_data = (const char*)d_file.map( 0, d_size );
+		if( d_data == 0 )
+		{
+			// Mapping not supported; go on in memory
+			d_fallback = d_file.readAll();
+			d_data = d_fallback.constData();
+			d_size = d_fallback.size();
+		}
+	}
+	d_pos = 0;
+	return detectCharset();
+}
+
+void HtmlTokenizer::close()
+{
+	if( d_data && d_fallback.isEmpty() )
+		d_file.unmap( (uchar*)d_data );
+	d_data = 0;
+	d_fallback.clear();
+	d_size = 0;
+	d_pos = 0;
+	d_file.close();
+	d_type = Eof;
+}
+
+QTextCodec* HtmlTokenizer::detectCodec( const char* data, qint64 size, int* bom )
+{
+	if( bom )
+		*bom = 0;
+	QByteArray charset;
+	if( size >= 3 && quint8(data[0]) == 0xef && quint8(data[1]) == 0xbb && quint8(data[2]) == 0xbf )
+	{
+		charset = "UTF-8";
+		if( bom )
+			*bom = 3;
+	}else if( size >= 2 && quint8(data[0]) == 0xff && quint8(data[1]) == 0xfe )
+	{
+		charset = "UTF-16LE";
+		if( bom )
+			*bom = 2;
+	}else if( size >= 2 && quint8(data[0]) == 0xfe && quint8(data[1]) == 0xff )
+	{
+		charset = "UTF-16BE";
+		if( bom )
+			*bom = 2;
+	}else
+	{
+		// <meta http-equiv="Content-Type" content="text/html; charset=windows-1252">, 
+		// <meta charset="utf-8"> or <?xml version="1.0" encoding="utf-8"?>
+		const int len = qMin( size, qint64( 8192 ) );
+		QByteArray head( data, len );
+		head = head.toLower();
+		int pos = head.indexOf( "charset=" );
+		int off = 8;
+		if( pos == -1 )
+		{
+			pos = head.indexOf( "encoding=" );
+			off = 9;
+		}
+		if( pos != -1 )
+		{
+			pos += off;
+			while( pos < len && ( head[pos] == '"' || head[pos] == '\'' || isSpace( head[pos] ) ) )
+				pos++;
+			const int start = pos;
+			while( pos < len && ( isAlpha( head[pos] ) || ( head[pos] >= '0' && head[pos] <= '9' ) || 
+				head[pos] == '-' || head[pos] == '_' || head[pos] == ':' || head[pos] == '.' ) )
+				pos++;
+			charset = head.mid( start, pos - start );
+		}
+	}
+	QTextCodec* codec = 0;
+	if( !charset.isEmpty() )
+		codec = QTextCodec::codecForName( charset );
+	if( codec == 0 )
+		codec = QTextCodec::codecForName( "ISO-8859-1" );
+	return codec;
+}
+
+bool HtmlTokenizer::detectCharset()
+{
+	int bom;
+	d_codec = detectCodec( d_data, d_size, &bom );
+	d_charset = d_codec->name();
+	d_pos = bom;
+	const int mib = d_codec->mibEnum();
+	if( mib == 1013 || mib == 1014 || mib == 1015 || mib == 1017 || mib == 1018 || mib == 1019 )
+	{
+		d_error = "UTF-16 and UTF-32 encoded files are not supported by the streaming importer";
+		return false;
+	}
+	return true;
+}
+
+bool HtmlTokenizer::startsWith( const char* str, bool caseInsensitive ) const
+{
+	qint64 i = 0;
+	while( str[i] )
+	{
+		if( d_pos + i >= d_size )
+			return false;
+		const char c = d_data[d_pos + i];
+		if( caseInsensitive ? ( toLower( c ) != str[i] ) : ( c != str[i] ) )
+			return false;
+		i++;
+	}
+	return true;
+}
+
+QString HtmlTokenizer::decode( qint64 from, qint64 to ) const
+{
+	return d_codec->toUnicode( d_data + from, to - from );
+}
+
+QString HtmlTokenizer::getAttribute( const QByteArray& name ) const
+{
+	for( int i = 0; i < d_atts.size(); i++ )
+		if( d_atts[i].first == name )
+			return d_atts[i].second;
+	return QString();
+}
+
+HtmlTokenizer::TokenType HtmlTokenizer::next()
+{
+	d_tag.clear();
+	d_text.clear();
+	d_atts.clear();
+	d_selfClosing = false;
+	while( !atEnd() )
+	{
+		if( ch() == '<' )
+		{
+			if( startsWith( "<!--" ) )
+			{
+				d_pos += 4;
+				while( !atEnd() && !startsWith( "-->" ) )
+					d_pos++;
+				d_pos += 3;
+				continue;
+			}else if( ch(1) == '!' || ch(1) == '?' )
+			{
+				while( !atEnd() && ch() != '>' )
+					d_pos++;
+				d_pos++;
+				continue;
+			}else if( ch(1) == '/' && isAlpha( ch(2) ) )
+			{
+				d_pos += 2;
+				while( !atEnd() && !isSpace( ch() ) && ch() != '>' )
+					d_tag += toLower( d_data[d_pos++] );
+				while( !atEnd() && ch() != '>' )
+					d_pos++;
+				d_pos++;
+				d_type = EndTag;
+				return d_type;
+			}else if( isAlpha( ch(1) ) )
+			{
+				d_pos++;
+				readTag();
+				if( !d_selfClosing && ( d_tag == "script" || d_tag == "style" ) )
+				{
+					skipRawText( d_tag.constData() );
+					d_tag.clear();
+					d_atts.clear();
+					continue;
+				}
+				d_type = StartTag;
+				return d_type;
+			}
+			// else a literal '<' which is part of the text
+		}
+		const qint64 start = d_pos;
+		d_pos++;
+		while( !atEnd() && ch() != '<' )
+			d_pos++;
+		d_text = resolveEntities( decode( start, d_pos ) );
+		d_type = Text;
+		return d_type;
+	}
+	d_type = Eof;
+	return d_type;
+}
+
+void HtmlTokenizer::readTag()
+{
+	while( !atEnd() && !isSpace( ch() ) && ch() != '>' && ch() != '/' )
+		d_tag += toLower( d_data[d_pos++] );
+	while( !atEnd() )
+	{
+		while( !atEnd() && isSpace( ch() ) )
+			d_pos++;
+		if( ch() == '>' )
+		{
+			d_pos++;
+			return;
+		}else if( ch() == '/' )
+		{
+			d_pos++;
+			if( ch() == '>' )
+			{
+				d_selfClosing = true;
+				d_pos++;
+				return;
+			}
+			continue;
+		}
+		QByteArray name;
+		while( !atEnd() && !isSpace( ch() ) && ch() != '=' && ch() != '>' && ch() != '/' )
+			name += toLower( d_data[d_pos++] );
+		while( !atEnd() && isSpace( ch() ) )
+			d_pos++;
+		QString value;
+		if( ch() == '=' )
+		{
+			d_pos++;
+			while( !atEnd() && isSpace( ch() ) )
+				d_pos++;
+			const char quote = ch();
+			if( quote == '"' || quote == '\'' )
+			{
+				d_pos++;
+				const qint64 start = d_pos;
+				while( !atEnd() && ch() != quote )
+					d_pos++;
+				value = resolveEntities( decode( start, d_pos ) );
+				d_pos++;
+			}else
+			{
+				const qint64 start = d_pos;
+				while( !atEnd() && !isSpace( ch() ) && ch() != '>' )
+					d_pos++;
+				value = resolveEntities( decode( start, d_pos ) );
+			}
+		}
+		if( !name.isEmpty() )
+			d_atts.append( Attribute( name, value ) );
+	}
+}
+
+void HtmlTokenizer::skipRawText( const char* endTag )
+{
+	const QByteArray end = QByteArray( "</" ) + endTag;
+	while( !atEnd() )
+	{
+		if( ch() == '<' && startsWith( end.constData(), true ) )
+		{
+			while( !atEnd() && ch() != '>' )
+				d_pos++;
+			d_pos++;
+			return;
+		}
+		d_pos++;
+	}
+}
+
+QString HtmlTokenizer::resolveEntities( const QString& str )
+{
+	int pos = str.indexOf( QChar('&') );
+	if( pos == -1 )
+		return str;
+	static QHash<QString,ushort> s_table;
+	if( s_table.isEmpty() )
+	{
+		for( int i = 0; s_entities[i].name; i++ )
+			s_table[ QString::fromLatin1( s_entities[i].name ) ] = s_entities[i].code;
+	}
+	QString res;
+	res.reserve( str.size() );
+	int last = 0;
+	while( pos != -1 )
+	{
+		res += str.mid( last, pos - last );
+		const int semi = str.indexOf( QChar(';'), pos + 1 );
+		ushort code = 0;
+		if( semi != -1 && semi - pos <= 10 )
+		{
+			const QString name = str.mid( pos + 1, semi - pos - 1 );
+			bool ok = false;
+			if( name.startsWith( QChar('#') ) )
+			{
+				if( name.size() > 1 && ( name[1] == QChar('x') || name[1] == QChar('X') ) )
+					code = name.mid( 2 ).toUShort( &ok, 16 );
+				else
+					code = name.mid( 1 ).toUShort( &ok, 10 );
+				if( !ok )
+					code = 0;
+			}else
+				code = s_table.value( name, 0 );
+		}
+		if( code != 0 )
+		{
+			res += QChar( code );
+			last = semi + 1;
+		}else
+		{
+			res += QChar('&');
+			last = pos + 1;
+		}
+		pos = str.indexOf( QChar('&'), last );
+	}
+	res += str.mid( last );
+	return res;
+}
@@ -0,0 +1,88 @@
+#ifndef HTMLTOKENIZER_H
+#define HTMLTOKENIZER_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+#include <QFile>
+
+class QTextCodec;
+
+// Lightweight pull tokenizer for large HTML files. The file is memory mapped and
+// scanned as bytes; only text and attribute values are decoded, using the charset
+// found in the BOM or the meta tag (ISO-8859-1 if none). Only ASCII compatible
+// charsets are supported, which covers what Word and DOORS export.
+// Comments, doctype, processing instructions and the contents of script and style
+// are skipped. No tree is built; memory is independent of the file size.
+class HtmlTokenizer
+{
+public:
+	enum TokenType { Eof, Text, StartTag, EndTag };
+	typedef QPair<QByteArray,QString> Attribute; // name is lower case
+
+	HtmlTokenizer();
+	~HtmlTokenizer();
+
+	bool open( const QString& path ); // return: false bei fehler
+	void close();
+	const QString& getError() const { return d_error; }
+	const QByteArray& getCharset() const { return d_charset; }
+
+	TokenType next();
+
+	// Values of the current token
+	TokenType getType() const { return d_type; }
+	const QByteArray& getTag() const { return d_tag; } // lower case
+	const QString& getText() const { return d_text; } // entities are resolved
+	const QList<Attribute>& getAttributes() const { return d_atts; }
+	QString getAttribute( const QByteArray& name ) const;
+	bool isSelfClosing() const { return d_selfClosing; }
+
+	static QString resolveEntities( const QString& );
+	// Charset of a document from its BOM resp. the charset or encoding declaration in the
+	// first 8 KB, ISO-8859-1 if none or unknown; bom is set to the length of the BOM.
+	// Also used by the tree based import, so that a document decodes the same at any size.
+	static QTextCodec* detectCodec( const char* data, qint64 size, int* bom = 0 );
+private:
+	bool detectCharset();
+	void readTag();
+	void skipRawText( const char* endTag );
+	bool startsWith( const char* str, bool caseInsensitive = false ) const;
+	QString decode( qint64 from, qint64 to ) const;
+	inline bool atEnd() const { return d_pos >= d_size; }
+	inline char ch( qint64 off = 0 ) const { return ( d_pos + off < d_size ) ? d_data[d_pos + off] : 0; }
+
+	QFile d_file;
+	QByteArray d_fallback;
+	const char* d_data;
+	qint64 d_size;
+	qint64 d_pos;
+	QTextCodec* d_codec;
+	QByteArray d_charset;
+	QString d_error;
+
+	TokenType d_type;
+	QByteArray d_tag;
+	QString d_text;
+	QList<Attribute> d_atts;
+	bool d_selfClosing;
+};
+
+#endif // HTMLTOKENIZER_H
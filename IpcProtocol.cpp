@@ -15,6 +15,18 @@
 */
 
 #include "IpcProtocol.h"
+#include "Pipeline.h"
+#include "ConnectionScheduler.h"
+#include "Tracer.h"
+#include <QTimer>
+#include <QApplication>
+#include <QClipboard>
+#include <QTcpSocket>
+#include <QLocalSocket>
+#include <QSettings>
+#include <QFile>
+#include <QDateTime>
+#include <string.h>
 
 enum ParamType 
 {
@@ -68,19 +80,193 @@ static const Command s_cmds[] =
 	{ "EndEmbedName", ParamString, ParamNone, ParamNone },		// 21
 	{ "PasteString", ParamNone, ParamNone, ParamNone },			// 22
 	{ "PasteStringName", ParamString, ParamNone, ParamNone },	// 23
+	{ "MappedString", ParamString, ParamBool, ParamInt },		// 24, path, delete, byte count
+	{ "MappedStringName", ParamString, ParamBool, ParamInt, ParamString },	// 25, path, delete, byte count, name
+	{ "RichText", ParamString, ParamNone, ParamNone },			// 26, DOORS rich text
+	{ "RichTextName", ParamString, ParamString, ParamNone },	// 27, DOORS rich text, name
+	{ "Batch", ParamNone, ParamNone, ParamNone },				// 28, byte count, commands; unpacked by parse
+	{ "DefineName", ParamInt, ParamString, ParamNone },			// 29, id, name; for the *Id commands
+	{ "StringValId", ParamString, ParamInt, ParamNone },		// 30, like StringValName with a name id
+	{ "IntValId", ParamInt, ParamInt, ParamNone },				// 31
+	{ "BoolValId", ParamBool, ParamInt, ParamNone },			// 32
+	{ "CharValId", ParamChar, ParamInt, ParamNone },			// 33
+	{ "RealValId", ParamReal, ParamInt, ParamNone },			// 34
+	{ "DateValId", ParamDate, ParamInt, ParamNone },			// 35
+	{ "LoadImgId", ParamString, ParamBool, ParamInt },			// 36, path, delete, name id
+	{ "StartFrameId", ParamInt, ParamNone, ParamNone },			// 37
+	{ "EndEmbedId", ParamInt, ParamNone, ParamNone },			// 38
+	{ "MappedStringId", ParamString, ParamBool, ParamInt, ParamInt },	// 39, path, delete, byte count, name id
+	{ "RichTextId", ParamString, ParamInt, ParamNone },			// 40
+	{ "StartDescriptor", ParamString, ParamNone, ParamNone },	// 41, key
+	{ "EndDescriptor", ParamNone, ParamNone, ParamNone },		// 42
+	{ "UseDescriptorName", ParamString, ParamString, ParamNone },	// 43, key, name
+	{ "UseDescriptorId", ParamString, ParamInt, ParamNone },	// 44, key, name id
+	{ "Mark", ParamString, ParamInt, ParamNone },				// 45, phase name, DOORS clock in ms; see TimingReport
 	{ 0, ParamNone, ParamNone, ParamNone },
 };
-static const int s_maxCommand = 23;
+static const int s_maxCommand = 45;
+static const int s_batchCommand = 28;
+static const int s_defineNameCommand = 29;
+static int s_nextId = 1;
+static const int s_maxNames = 4096; // interned slot names per connection
+static const int s_maxNameIds = 0x10000; // ids of DefineName per connection
 
-IpcProtocol::IpcProtocol(QObject *parent)
-	: QObject(parent), d_state( Idle )
+// Index of the parameter holding the slot resp. frame name, i.e. the trailing string of
+// the *Name commands; -1 if there is none
+static int s_nameParam[s_maxCommand + 1];
+// Same for the name id, i.e. the trailing int of the *Id commands
+static int s_idParam[s_maxCommand + 1];
+// The *Id commands are applied as their *Name counterpart; the others map to themselves
+static int s_baseCmd[s_maxCommand + 1];
+
+static int lastParam( int cmd )
+{
+	int last = 0;
+	while( last + 1 < IpcProtocol::s_maxParam && s_cmds[cmd].param[last + 1] != ParamNone )
+		last++;
+	return last;
+}
+
+static void initNameParams()
 {
+	static bool done = false;
+	if( done )
+		return;
+	for( int i = 0; i <= s_maxCommand; i++ )
+	{
+		s_nameParam[i] = -1;
+		s_idParam[i] = -1;
+		s_baseCmd[i] = i;
+		const int len = ::strlen( s_cmds[i].name );
+		const int last = lastParam( i );
+		if( len > 4 && ::strcmp( s_cmds[i].name + len - 4, "Name" ) == 0 && 
+			s_cmds[i].param[last] == ParamString )
+			s_nameParam[i] = last;
+		else if( len > 2 && ::strcmp( s_cmds[i].name + len - 2, "Id" ) == 0 && 
+			s_cmds[i].param[last] == ParamInt )
+		{
+			s_idParam[i] = last;
+			const QByteArray named = QByteArray( s_cmds[i].name, len - 2 ) + "Name";
+			for( int j = 0; j <= s_maxCommand; j++ )
+				if( named == s_cmds[j].name )
+					s_baseCmd[i] = j;
+			Q_ASSERT( s_baseCmd[i] != i );
+		}
+	}
+	done = true;
+}
 
+// Like QByteArray::toInt, but on the NUL terminated parse buffer without a copy
+static int parseInt( const char* str, bool* ok )
+{
+	const char* p = str;
+	bool neg = false;
+	if( *p == '-' || *p == '+' )
+		neg = ( *p++ == '-' );
+	qint64 res = 0;
+	*ok = *p != 0;
+	while( *p )
+	{
+		if( *p < '0' || *p > '9' || res > 0x7fffffff )
+		{
+			*ok = false;
+			return 0;
+		}
+		res = res * 10 + ( *p++ - '0' );
+	}
+	if( res > 0x7fffffff + qint64( neg ) )
+		*ok = false;
+	return ( neg ) ? int( -res ) : int( res );
+}
+
+IpcProtocol::IpcProtocol(QObject *parent)
+	: QObject(parent), d_state( Idle ), d_batchLeft( -1 ), d_len( 0 ), d_execTime( 0 ), d_metricsTimer( 0 ), d_pipe( 0 ),
+	d_stalled( 0 ), d_retryTimer( 0 ), d_scheduled( false )
+{
+	initNameParams();
+	d_id = s_nextId++;
+	d_agent.setTrack( d_id );
+	QSettings set;
+	d_metricsPath = set.value( "MetricsFile" ).toString();
+	const int interval = set.value( "MetricsInterval", 60 ).toInt();
+	if( !d_metricsPath.isEmpty() && interval > 0 )
+	{
+		d_metricsTimer = new QTimer( this );
+		connect( d_metricsTimer, SIGNAL( timeout() ), this, SLOT( dumpMetrics() ) );
+		d_metricsTimer->start( interval * 1000 );
+	}
+	d_scheduled = set.value( "FairScheduling", false ).toBool();
+	if( set.value( "Pipeline", false ).toBool() )
+	{
+		d_pipe = new Pipeline( this, set.value( "PipelineDepth", 4096 ).toInt() );
+		d_retryTimer = new QTimer( this );
+		d_retryTimer->setSingleShot( true );
+		connect( d_retryTimer, SIGNAL( timeout() ), this, SLOT( onRetry() ) );
+	}
+	if( d_pipe != 0 || d_scheduled )
+	{
+		// Don't let Qt buffer the whole export in memory while the pipeline is full resp. the
+		// connection waits for its turn; the parent is the socket, see DoorScopeEtl::setupConnection
+		const qint64 readBuffer = 4 * 1024 * 1024;
+		if( QAbstractSocket* tcp = qobject_cast<QAbstractSocket*>( parent ) )
+			tcp->setReadBufferSize( readBuffer );
+		else if( QLocalSocket* local = qobject_cast<QLocalSocket*>( parent ) )
+			local->setReadBufferSize( readBuffer );
+	}
 }
 
 IpcProtocol::~IpcProtocol()
 {
+	delete d_pipe; // applies what is left to d_agent
+}
 
+void IpcProtocol::waitForWriter()
+{
+	if( d_pipe )
+		d_pipe->waitForIdle();
+}
+
+void IpcProtocol::onRetry()
+{
+	if( d_stalled == 0 )
+		return;
+	if( !d_pipe->push( d_rec ) )
+	{
+		d_retryTimer->start( 1 );
+		return;
+	}
+	QIODevice* sock = d_stalled;
+	d_stalled = 0;
+	if( d_rec.d_cmd == 1 )
+		closed();
+	if( d_scheduled )
+		ConnectionScheduler::instance()->schedule( this, sock );
+	else
+		parse( sock );
+}
+
+void IpcProtocol::onDisconnected()
+{
+	// The DXL script never closes the channel; the socket disconnects when the script ends,
+	// possibly with the end of the export still unread, waiting for its turn in the
+	// ConnectionScheduler resp. waiting in d_rec for room in the Pipeline. The socket deletes
+	// us later, so everything is parsed and pushed here at once.
+	QIODevice* sock = (QIODevice*) sender();
+	if( !sock->isOpen() )
+		return; // closed by errorClose
+	if( d_retryTimer )
+		d_retryTimer->stop();
+	do
+	{
+		if( d_stalled != 0 )
+		{
+			d_pipe->pushWait( d_rec );
+			d_stalled = 0;
+			if( d_rec.d_cmd == 1 )
+				closed();
+		}
+		parse( sock );
+	}while( d_stalled != 0 );
 }
 
 void IpcProtocol::onError(QAbstractSocket::SocketError)
@@ -89,38 +275,138 @@ void IpcProtocol::onError(QAbstractSocket::SocketError)
 	d_agent.onError( sock->errorString() );
 }
 
+void IpcProtocol::onLocalError(QLocalSocket::LocalSocketError)
+{
+	QLocalSocket* sock = (QLocalSocket*) sender();
+	d_agent.onError( sock->errorString() );
+}
+
 void IpcProtocol::onData()
 {
 	QIODevice* sock = (QIODevice*) sender();
+	if( d_scheduled )
+	{
+		ConnectionScheduler::instance()->schedule( this, sock );
+		return;
+	}
+	if( !Tracer::isOn() )
+	{
+		parse( sock );
+		return;
+	}
+	const quint64 start = Metrics::now();
+	const quint64 bytes = d_agent.d_metrics.d_bytesReceived;
 	parse( sock );
+	Tracer::complete( "readyRead", "io", d_id, start, Metrics::now(),
+		"\"bytes\":" + QByteArray::number( d_agent.d_metrics.d_bytesReceived - bytes ) );
 }
 
-void IpcProtocol::parse(QIODevice* sock)
+const char* IpcProtocol::commandName( int cmd )
+{
+	if( cmd < 0 || cmd > s_maxCommand )
+		return "";
+	return s_cmds[cmd].name;
+}
+
+void IpcProtocol::dumpMetrics( const char* event )
+{
+	if( d_metricsPath.isEmpty() )
+		return;
+	const Snapshot s = snapshot();
+	const Metrics& m = s.d_metrics;
+	QByteArray line = "{\"ts\":\"" + QDateTime::currentDateTime().toString( Qt::ISODate ).toLatin1();
+	line += "\",\"conn\":" + QByteArray::number( d_id );
+	line += ",\"event\":\"";
+	line += event;
+	line += "\",\"module\":" + Metrics::jsonString( s.d_name ) + ",";
+	m.writeJson( line );
+	// Only at close, when the writer thread is done with d_timing
+	if( ::strcmp( event, "close" ) == 0 && !d_timing.isEmpty() )
+	{
+		line += ',';
+		d_timing.writeJson( line );
+	}
+	line += ",\"commands\":{";
+	bool first = true;
+	for( int i = 0; i <= s_maxCommand; i++ )
+	{
+		if( m.d_commands[i] == 0 )
+			continue;
+		if( !first )
+			line += ',';
+		first = false;
+		line += '"';
+		line += s_cmds[i].name;
+		line += "\":" + QByteArray::number( m.d_commands[i] );
+	}
+	line += "}}\n";
+	QFile out( d_metricsPath );
+	if( out.open( QIODevice::Append ) )
+		out.write( line );
+}
+
+bool IpcProtocol::parse(QIODevice* sock, qint64 maxBytes, quint64 maxNs )
 {
 	char ch;
 	bool ok;
-	while( sock->isOpen() && sock->bytesAvailable() )
+	const quint64 start = Metrics::now();
+	d_execTime = 0;
+	qint64 count = 0;
+	while( d_stalled == 0 && sock->isOpen() && sock->bytesAvailable() )
 	{
+		if( maxBytes >= 0 && count >= maxBytes )
+			break;
+		if( maxNs != 0 && ( count & 0x3ff ) == 0x3ff && Metrics::now() - start >= maxNs )
+			break;
+		count++;
 		sock->getChar( &ch );
+		d_agent.d_metrics.d_bytesReceived++;
+		if( d_batchLeft >= 0 )
+		{
+			// Inside a Batch envelope; the payload consists of complete commands followed by BAR
+			if( d_batchLeft == 0 )
+			{
+				if( ch != '|' || d_state != Idle )
+					errorClose( sock, "Expecting BAR after batch" );
+				d_batchLeft = -1;
+				continue;
+			}
+			d_batchLeft--;
+		}
 		switch( d_state )
 		{
 		case Idle:
 			if( ch != ' ' )
 			{
 				d_state = ReadCode;
-				d_buf.clear();
-				d_buf.append( ch );
+				clearBuf();
+				put( ch );
 			}
 			break;
 		case ReadCode:
 			if( ch != '|' )
-				d_buf.append( ch );
+				put( ch );
 			else
 			{
-				d_command = d_buf.toUInt( &ok );
-				if( !ok || d_command > s_maxCommand )
+				d_command = parseInt( d_buf.constData(), &ok );
+				if( !ok || d_command < 0 || d_command > s_maxCommand )
+				{
+					errorClose( sock, "Invalid command " + buf() );
+					break;
+				}
+				d_rec.d_cmd = s_baseCmd[d_command];
+				d_rec.d_name = QByteArray();
+				if( d_command == s_batchCommand )
 				{
-					errorClose( sock, "Invalid command " + d_buf );
+					d_agent.d_metrics.d_commands[d_command]++;
+					if( d_batchLeft >= 0 )
+						errorClose( sock, "Nested batch" );
+					else
+					{
+						clearBuf();
+						d_state = ReadBatch;
+					}
+					break;
 				}
 				// d_agent.onTrace( s_cmds[ d_command ].name ); // TEST
 
@@ -130,7 +416,7 @@ void IpcProtocol::parse(QIODevice* sock)
 				}else
 				{
 					d_pn = 0;
-					d_buf.clear();
+					clearBuf();
 					if( s_hasNum[s_cmds[ d_command ].param[d_pn]] )
 						d_state = ReadNum;
 					else
@@ -138,19 +424,33 @@ void IpcProtocol::parse(QIODevice* sock)
 				}
 			}
 			break;
+		case ReadBatch:
+			if( ch != '|' )
+				put( ch );
+			else
+			{
+				d_batchLeft = parseInt( d_buf.constData(), &ok );
+				if( !ok || d_batchLeft < 0 )
+				{
+					d_batchLeft = -1;
+					errorClose( sock, "Invalid batch size " + buf() );
+				}else
+					d_state = Idle;
+			}
+			break;
 		case ReadNum:
 			if( ch != '|' )
-				d_buf.append( ch );
+				put( ch );
 			else
 			{
-				d_num = d_buf.toUInt( &ok );
-				if( !ok )
+				d_num = parseInt( d_buf.constData(), &ok );
+				if( !ok || d_num < 0 )
 				{
-					errorClose( sock, "Invalid string count " + d_buf );
+					errorClose( sock, "Invalid string count " + buf() );
 				}else
 				{
 					d_state = ReadVal;
-					d_buf.clear();
+					clearBuf();
 				}
 			}
 			break;
@@ -164,7 +464,7 @@ void IpcProtocol::parse(QIODevice* sock)
 					if( d_num > 0 )
 					{
 						// Lese weiteres Zeichen des Strings
-						d_buf.append( ch );
+						put( ch );
 						// DOORS sendet anscheinend die Strings als UTF-8 ber das Netz (nirgends dokumentiert!)
 						// Die Anzahl bezieht sich aber auf den Originalstring, d.h. es kommen mehr Bytes als gezhlt!
 						if( false ) // quint8(ch) & 0x80 )
@@ -187,7 +487,7 @@ void IpcProtocol::parse(QIODevice* sock)
 						// Lese auf den String folgendes Trennzeichen
 						if( ch != '|' )
 						{
-							errorClose( sock, "Expecting BAR after string: " + d_buf );
+							errorClose( sock, "Expecting BAR after string: " + buf() );
 						}
 						d_num--;
 						doit = true;
@@ -198,7 +498,7 @@ void IpcProtocol::parse(QIODevice* sock)
 					if( ch != '|' )
 					{
 						// Lese weitere Zeichen des Werts
-						d_buf.append( ch );
+						put( ch );
 					}else
 					{
 						doit = true;
@@ -212,7 +512,11 @@ void IpcProtocol::parse(QIODevice* sock)
 			break;
 		}
 	}
+	d_agent.d_metrics.d_ns[Metrics::Parse] += Metrics::now() - start - d_execTime;
+	d_agent.d_metrics.d_liveBytes.fetchAndAddRelaxed( int( count ) );
+	return d_stalled == 0 && sock->isOpen() && sock->bytesAvailable() > 0;
 }
+
 void IpcProtocol::evaluate(QIODevice* sock)
 {
 	// Speichere den Wert als Param
@@ -225,7 +529,7 @@ void IpcProtocol::evaluate(QIODevice* sock)
 	}else
 	{
 		// Es kommen noch weitere Params
-		d_buf.clear();
+		clearBuf();
 		if( s_hasNum[s_cmds[ d_command ].param[d_pn]] )
 			d_state = ReadNum;
 		else
@@ -233,70 +537,150 @@ void IpcProtocol::evaluate(QIODevice* sock)
 	}
 }
 
-void IpcProtocol::errorClose( QIODevice* sock, QString msg )
+void IpcProtocol::errorClose( QIODevice* sock, const QString& msg )
 {
 	d_agent.onError( msg );
 	sock->close();
 	d_state = Idle;
+	d_batchLeft = -1;
 }
 
 void IpcProtocol::execute(QIODevice* sock)
 {
-	switch( d_command )
+	const quint64 start = Metrics::now();
+	d_agent.d_metrics.d_commands[d_command]++;
+	d_state = Idle;
+	if( d_command == s_defineNameCommand )
+	{
+		const int id = d_rec.d_int;
+		if( id < 0 || id >= s_maxNameIds )
+			errorClose( sock, QString( "invalid name id %1" ).arg( id ) );
+		else
+		{
+			if( id >= d_ids.size() )
+				d_ids.resize( id + 1 );
+			d_ids[id] = d_rec.d_name;
+		}
+	}else if( d_pipe == 0 )
+	{
+		apply( d_rec );
+		if( d_rec.d_cmd == 1 )
+			closed();
+	}else
+	{
+		if( d_rec.d_cmd == 22 || d_rec.d_cmd == 23 )
+		{
+			// The clipboard is only accessible from the GUI thread
+			d_rec.d_str = QApplication::clipboard()->text();
+			d_rec.d_cmd = ( d_rec.d_cmd == 22 ) ? 2 : 3; // StringVal(Name)
+		}
+		if( !d_pipe->push( d_rec ) )
+		{
+			// Backpressure: stop reading until the writer has made room
+			d_stalled = sock;
+			d_retryTimer->start( 1 );
+		}else if( d_rec.d_cmd == 1 )
+			closed();
+	}
+	d_execTime += Metrics::now() - start;
+}
+
+void IpcProtocol::closed()
+{
+	// Runs on the parsing thread once CloseStream is applied resp. pushed to the Pipeline.
+	// After waitForWriter the writer only reads the agent in publish, so the counters are
+	// complete and can be reset here, where the parser and the metrics timer run as well.
+	waitForWriter();
+	d_timing.finish( d_agent.d_metrics.d_ns[Metrics::Write] + d_agent.d_metrics.d_ns[Metrics::Image] );
+	if( !d_timing.isEmpty() )
+	{
+		const QStringList lines = d_timing.toLines();
+		for( int i = 0; i < lines.size(); i++ )
+			d_agent.onStatus( "Timing " + lines[i] );
+	}
+	publish();
+	dumpMetrics( "close" );
+	{
+		QMutexLocker lock( &d_snapLock );
+		d_agent.d_metrics.reset();
+	}
+	d_timing.reset();
+	publish();
+}
+
+IpcProtocol::Snapshot IpcProtocol::snapshot() const
+{
+	Snapshot s;
+	if( d_pipe == 0 )
+	{
+		s.d_name = d_agent.getName();
+		s.d_embedDepth = d_agent.getEmbedDepth();
+		s.d_metrics = d_agent.d_metrics;
+		return s;
+	}
+	{
+		QMutexLocker lock( &d_snapLock );
+		s = d_snap;
+	}
+	s.d_metrics.copyParserCounters( d_agent.d_metrics );
+	return s;
+}
+
+void IpcProtocol::publish()
+{
+	if( d_pipe == 0 )
+		return;
+	QMutexLocker lock( &d_snapLock );
+	d_snap.d_name = d_agent.getName();
+	d_snap.d_embedDepth = d_agent.getEmbedDepth();
+	d_snap.d_metrics.copyAgentCounters( d_agent.d_metrics );
+}
+
+void IpcProtocol::apply( const Record& r )
+{
+	const quint64 start = Metrics::now();
+	switch( r.d_cmd )
 	{
 	case 0: // OpenStream
-		d_agent.open( d_param[0].toString() );
+		d_agent.open( r.d_str );
+		publish();
+		if( Tracer::isOn() )
+			Tracer::nameTrack( d_id, QString( "#%1 %2" ).arg( d_id ).arg( d_agent.getName() ) );
 		break;
 	case 1: // CloseStream
-		d_agent.close();
+		d_agent.close(); // the rest is done by closed() on the parsing thread
 		break;
 	case 2: // StringVal
-		d_agent.writeString( d_param[0].toString() );
-		break;
 	case 3: // StringValName
-		d_agent.writeString( d_param[0].toString(), d_param[1].toByteArray() );
+		d_agent.writeString( r.d_str, r.d_name );
 		break;
 	case 4: // IntVal
-		d_agent.writeInt( d_param[0].toInt() );
-		break;
 	case 5: // IntValName
-		d_agent.writeInt( d_param[0].toInt(), d_param[1].toByteArray() );
+		d_agent.writeInt( r.d_int, r.d_name );
 		break;
 	case 6: // BoolVal
-		d_agent.writeBool( d_param[0].toBool() );
-		break;
 	case 7: // BoolValName
-		d_agent.writeBool( d_param[0].toBool(), d_param[1].toByteArray() );
+		d_agent.writeBool( r.d_int, r.d_name );
 		break;
 	case 8: // CharVal
-		d_agent.writeChar( d_param[0].toChar().toLatin1() );
-		break;
 	case 9: // CharValName
-		d_agent.writeChar( d_param[0].toChar().toLatin1(), d_param[1].toByteArray() );
+		d_agent.writeChar( r.d_int, r.d_name );
 		break;
 	case 10: // RealVal
-		d_agent.writeReal( d_param[0].toDouble() );
-		break;
 	case 11: // RealValName
-		d_agent.writeReal( d_param[0].toDouble(), d_param[1].toByteArray() );
+		d_agent.writeReal( r.d_real, r.d_name );
 		break;
 	case 12: // DateVal
-		d_agent.writeDate( d_param[0].toDateTime() );
-		break;
 	case 13: // DateValName
-		d_agent.writeDate( d_param[0].toDateTime(), d_param[1].toByteArray() );
+		d_agent.writeDate( r.d_date, r.d_name );
 		break;
 	case 14: // LoadImg
-		d_agent.loadImg( d_param[0].toString(), d_param[1].toBool() );
-		break;
 	case 15: // LoadImgName
-		d_agent.loadImg( d_param[0].toString(), d_param[1].toBool(), d_param[2].toByteArray() );
+		d_agent.loadImg( r.d_str, r.d_delete, r.d_name );
 		break;
 	case 16: // StartFrame
-		d_agent.startFrame();
-		break;
 	case 17: // StartFrameName
-		d_agent.startFrame( d_param[0].toByteArray() );
+		d_agent.startFrame( r.d_name );
 		break;
 	case 18: // EndFrame
 		d_agent.endFrame();
@@ -305,57 +689,89 @@ void IpcProtocol::execute(QIODevice* sock)
 		d_agent.startEmbed();
 		break;
 	case 20: // EndEmbed
-		d_agent.endEmbed();
-		break;
 	case 21: // EndEmbedName
-		d_agent.endEmbed( d_param[0].toByteArray() );
+		d_agent.endEmbed( r.d_name );
 		break;
 	case 22: // PasteString
-		d_agent.pasteString();
-		break;
 	case 23: // PasteStringName
-		d_agent.pasteString( d_param[0].toByteArray() );
+		d_agent.pasteString( r.d_name );
+		break;
+	case 24: // MappedString
+	case 25: // MappedStringName
+		d_agent.mappedString( r.d_str, r.d_int, r.d_delete, r.d_name );
+		break;
+	case 26: // RichText
+	case 27: // RichTextName
+		d_agent.writeRichText( r.d_str, r.d_name );
+		break;
+	case 41: // StartDescriptor
+		d_agent.startDescriptor( r.d_str );
+		break;
+	case 42: // EndDescriptor
+		d_agent.endDescriptor();
+		break;
+	case 43: // UseDescriptorName
+		d_agent.useDescriptor( r.d_str, r.d_name );
+		break;
+	case 45: // Mark
+		d_timing.mark( r.d_str, r.d_int, d_agent.d_metrics.d_ns[Metrics::Write] + d_agent.d_metrics.d_ns[Metrics::Image] );
 		break;
 	}
-	d_state = Idle;
+	if( Tracer::isOn() && Tracer::sample() )
+		Tracer::complete( s_cmds[r.d_cmd].name, "cmd", d_id, start, Metrics::now() );
 }
 
 void IpcProtocol::consume( QIODevice* sock )
 {
+	// Writes the parameter directly into d_rec; d_buf is NUL terminated and keeps its capacity
 	bool ok;
+	const char* str = d_buf.constData();
 	switch( s_cmds[ d_command ].param[d_pn] )
 	{
 	case ParamString:
-		d_param[d_pn] = QString::fromUtf8( d_buf ); 
+		if( s_nameParam[d_command] == d_pn )
+			d_rec.d_name = internName();
+		else
+			d_rec.d_str = QString::fromUtf8( str, d_len ); 
 		break;
 	case ParamInt:
-		d_param[d_pn] = d_buf.toInt( &ok );
+		if( s_idParam[d_command] == d_pn )
+		{
+			const int id = parseInt( str, &ok );
+			if( ok && id >= 0 && id < d_ids.size() && !d_ids[id].isNull() )
+				d_rec.d_name = d_ids[id];
+			else
+				errorClose( sock, "undefined name id " + buf() );
+			break;
+		}
+		d_rec.d_int = parseInt( str, &ok );
 		if( !ok )
 		{
-			errorClose( sock, "invalid integer " + d_buf );
+			errorClose( sock, "invalid integer " + buf() );
 		}
 		break;
 	case ParamChar:
-		if( d_buf.size() == 1 )
+		if( d_len == 1 )
 		{
-			d_param[d_pn] = QChar( d_buf[0] );
+			d_rec.d_int = quint8( str[0] );
 		}else
-			errorClose( sock, "invalid char " + d_buf );
+			errorClose( sock, "invalid char " + buf() );
 		break;
 	case ParamBool:
-		if( d_buf == "0" )
-			d_param[d_pn] = false;
-		else if( d_buf == "1" )
-			d_param[d_pn] = true;
-		else
-			errorClose( sock, "invalid bool " + d_buf );
+		if( d_len == 1 && ( str[0] == '0' || str[0] == '1' ) )
+		{
+			d_rec.d_int = str[0] == '1';
+			d_rec.d_delete = d_rec.d_int; // the only bool of LoadImg and MappedString
+		}else
+			errorClose( sock, "invalid bool " + buf() );
 		break;
 	case ParamReal:
 		// Als String der form "3.141593"
-		d_param[d_pn] = d_buf.toDouble( &ok );
+		// QByteArray::toDouble is locale independent, strtod is not once Qt has called setlocale
+		d_rec.d_real = QByteArray( str, d_len ).toDouble( &ok );
 		if( !ok )
 		{
-			errorClose( sock, "invalid real " + d_buf );
+			errorClose( sock, "invalid real " + buf() );
 		}
 		break;
 	case ParamDate:
@@ -364,17 +780,28 @@ void IpcProtocol::consume( QIODevice* sock )
 			// ISO-Format wird auch nicht untersttzt. stringOf kann Time nicht formatieren.
 			// Daher stringOf( date, "yyyy-MM-dd" ) ergibt "2009-02-21 14:23:12" oder "2009-02-21"
 			// je nachdem includesTime(date) true oder false; siehe auch dateAndTime(date)
+			// Consecutive objects mostly carry the same dates, so the last one is cached
+			if( d_lastDateStr.size() == d_len && ::memcmp( d_lastDateStr.constData(), str, d_len ) == 0 )
+			{
+				d_rec.d_date = d_lastDate;
+				break;
+			}
+			const QString s = QString::fromLatin1( str, d_len );
 			QDateTime dt;
-			dt = QDateTime::fromString( d_buf, "yyyy-MM-dd h:m:s" );
+			dt = QDateTime::fromString( s, "yyyy-MM-dd h:m:s" );
 			if( !dt.isValid() )
-				dt = QDateTime::fromString( d_buf, "yyyy-MM-dd" );
+				dt = QDateTime::fromString( s, "yyyy-MM-dd" );
 			if( !dt.isValid() )
-				dt = QDateTime::fromString( d_buf, "h:m:s" );
+				dt = QDateTime::fromString( s, "h:m:s" );
 			if( !dt.isValid() )
 			{
-				errorClose( sock, "invalid date " + d_buf );
+				errorClose( sock, "invalid date " + buf() );
+			}else
+			{
+				d_lastDateStr = QByteArray( str, d_len );
+				d_lastDate = dt;
 			}
-			d_param[d_pn] = dt;
+			d_rec.d_date = dt;
 		}
 		break;
 	default:
@@ -382,3 +809,17 @@ void IpcProtocol::consume( QIODevice* sock )
 		break;
 	}
 }
+
+QByteArray IpcProtocol::internName()
+{
+	// DOORS sends the same few attribute names for every object; the pool hands out shared
+	// copies instead of converting and allocating each name again
+	const QByteArray raw = buf();
+	QHash<QByteArray,QByteArray>::const_iterator i = d_names.find( raw );
+	if( i != d_names.end() )
+		return i.value();
+	const QByteArray name = QString::fromUtf8( raw.constData(), raw.size() ).toAscii();
+	if( d_names.size() < s_maxNames )
+		d_names.insert( QByteArray( raw.constData(), raw.size() ), name );
+	return name;
+}
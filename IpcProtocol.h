@@ -19,8 +19,16 @@
 
 #include <QObject>
 #include <QTcpSocket>
+#include <QLocalSocket>
+#include <QDateTime>
+#include <QHash>
+#include <QVector>
+#include <QMutex>
 #include "StreamAgent.h"
 
+class QTimer;
+class Pipeline;
+
 class IpcProtocol : public QObject
 {
 	Q_OBJECT
@@ -30,30 +38,109 @@ public:
 	~IpcProtocol();
 
 	StreamAgent d_agent;
-	enum { s_maxParam = 3 };
-	void parse( QIODevice* );
+	enum { s_maxParam = 4 };
+
+	// One decoded command. Filled by the parser and applied to d_agent either directly or,
+	// with the Pipeline setting, on the writer thread of the Pipeline.
+	struct Record
+	{
+		int d_cmd;
+		int d_int; // IntVal, CharVal, BoolVal, byte count, delete flag of LoadImg
+		bool d_delete; // delete flag of LoadImg and MappedString
+		double d_real;
+		QString d_str; // string value, stream name or file path
+		QByteArray d_name; // slot, frame or embed name
+		QDateTime d_date;
+		Record():d_cmd(-1),d_int(0),d_delete(false),d_real(0.0){}
+	};
+	void apply( const Record& );
+
+	// Name and counters of the agent for the thread parsing the connection, e.g. the GUI.
+	// With the Pipeline the agent belongs to the writer thread, which publishes a copy
+	// from time to time; the parser counters are always current.
+	struct Snapshot
+	{
+		QString d_name;
+		int d_embedDepth;
+		Metrics d_metrics;
+		Snapshot():d_embedDepth(0){}
+	};
+	Snapshot snapshot() const;
+	void publish(); // called by the thread owning d_agent
+
+	// Parses at most maxBytes resp. for about maxNs if given; returns true if data is left
+	bool parse( QIODevice*, qint64 maxBytes = -1, quint64 maxNs = 0 );
+	bool isPipelined() const { return d_pipe != 0; }
+	void waitForWriter(); // returns when the pipeline has applied all parsed commands
+	int getId() const { return d_id; }
+	void setPeer( const QString& peer ) { d_peer = peer; }
+	const QString& getPeer() const { return d_peer; }
+	static const char* commandName( int );
 public slots:
 	void onError(QAbstractSocket::SocketError);
+	void onLocalError(QLocalSocket::LocalSocketError);
 	void onData();
+	void onDisconnected();
+	void dumpMetrics( const char* event = "interval" );
+protected slots:
+	void onRetry();
 protected:
-	void errorClose( QIODevice*, QString );
+	void errorClose( QIODevice*, const QString& );
 	void execute(QIODevice*);
 	void consume( QIODevice* );
 	void evaluate( QIODevice* );
+	void closed();
+	QByteArray internName();
+	inline void put( char ch )
+	{
+		if( d_len + 1 >= d_buf.size() )
+			d_buf.resize( qMax( 64, d_buf.size() * 2 ) );
+		char* p = d_buf.data();
+		p[d_len++] = ch;
+		p[d_len] = 0;
+	}
+	inline void clearBuf()
+	{
+		d_len = 0;
+		if( d_buf.size() > 0x100000 )
+			d_buf = QByteArray(); // don't keep the capacity of a huge string forever
+		else if( !d_buf.isEmpty() )
+			d_buf.data()[0] = 0;
+	}
+	QByteArray buf() const { return QByteArray::fromRawData( d_buf.constData(), d_len ); }
 private:
 	enum State 
 	{
 		Idle,
 		ReadCode,
 		ReadNum,
-		ReadVal
+		ReadVal,
+		ReadBatch
 	};
 	int d_state;
+	int d_batchLeft; // payload bytes of the current Batch still to read; -1 outside of a batch
 	int d_command;
 	int d_num;
 	int d_pn;
-	QVariant d_param[s_maxParam];
-	QByteArray d_buf;
+	QByteArray d_buf; // NUL terminated at d_len, capacity is reused
+	int d_len;
+	QHash<QByteArray,QByteArray> d_names; // wire bytes -> slot name
+	QVector<QByteArray> d_ids; // DefineName id -> slot name
+	QByteArray d_lastDateStr;
+	QDateTime d_lastDate;
+	int d_id;
+	quint64 d_execTime;
+	QTimer* d_metricsTimer;
+	QString d_metricsPath;
+	QString d_peer;
+	Record d_rec;
+	Pipeline* d_pipe;
+	QIODevice* d_stalled; // pipeline was full; parsing resumes from onRetry
+	QTimer* d_retryTimer;
+	bool d_scheduled; // parse in turns, see ConnectionScheduler
+	TimingReport d_timing; // of the current stream, from the Mark commands
+	mutable QMutex d_snapLock;
+	Snapshot d_snap; // published by the writer thread
 };
 
 #endif // IPCPROTOCOL_H
@@ -0,0 +1,157 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+#include "LogModel.h"
+#include <QTimer>
+#include <QSettings>
+#include <QFile>
+#include <QTextStream>
+
+LogModel::LogModel( QObject* parent ):QAbstractListModel( parent ),d_first(0),d_next(0),d_minKind(0)
+{
+	QSettings set;
+	d_ring.resize( qMax( set.value( "LogCapacity", 100000 ).toInt(), 1 ) );
+	d_timer = new QTimer( this );
+	d_timer->setSingleShot( true );
+	d_timer->setInterval( set.value( "LogInterval", 100 ).toInt() ); // ms
+	connect( d_timer, SIGNAL( timeout() ), this, SLOT( onFlush() ) );
+}
+
+void LogModel::append( const QString& text, int kind )
+{
+	d_pending.append( Record( text, kind ) );
+	if( !d_timer->isActive() )
+		d_timer->start();
+}
+
+void LogModel::onFlush()
+{
+	if( d_pending.isEmpty() )
+		return;
+	const quint64 cap = d_ring.size();
+	// Of a burst larger than the ring only the tail survives
+	if( quint64( d_pending.size() ) > cap )
+	{
+		const int skip = d_pending.size() - int( cap );
+		d_next += skip;
+		d_pending = d_pending.mid( skip );
+	}
+	const quint64 newNext = d_next + d_pending.size();
+	const quint64 newFirst = ( newNext > cap ) ? qMax( d_first, newNext - cap ) : d_first;
+
+	int dropped = 0;
+	while( dropped < d_rows.size() && d_rows[dropped] < newFirst )
+		dropped++;
+	if( dropped > 0 )
+	{
+		beginRemoveRows( QModelIndex(), 0, dropped - 1 );
+		for( int i = 0; i < dropped; i++ )
+			d_rows.removeFirst();
+		endRemoveRows();
+	}
+
+	QList<quint64> added;
+	for( int i = 0; i < d_pending.size(); i++ )
+	{
+		const quint64 seq = d_next + i;
+		d_ring[ seq % cap ] = d_pending[i];
+		if( d_pending[i].d_kind >= d_minKind )
+			added.append( seq );
+	}
+	d_pending.clear();
+	d_next = newNext;
+	d_first = newFirst;
+	if( !added.isEmpty() )
+	{
+		beginInsertRows( QModelIndex(), d_rows.size(), d_rows.size() + added.size() - 1 );
+		d_rows += added;
+		endInsertRows();
+	}
+}
+
+void LogModel::clear()
+{
+	d_pending.clear();
+	d_first = d_next;
+	d_rows.clear();
+	reset();
+}
+
+void LogModel::setMinKind( int kind )
+{
+	if( kind == d_minKind )
+		return;
+	onFlush();
+	d_minKind = kind;
+	d_rows.clear();
+	for( quint64 seq = d_first; seq < d_next; seq++ )
+		if( at( seq ).d_kind >= d_minKind )
+			d_rows.append( seq );
+	reset();
+}
+
+bool LogModel::save( const QString& path ) const
+{
+	QFile f( path );
+	if( !f.open( QIODevice::WriteOnly | QIODevice::Text ) )
+		return false;
+	QTextStream out( &f );
+	out.setCodec( "UTF-8" );
+	if( d_first > 0 )
+		out << "(" << d_first << " older records dropped or cleared)" << endl;
+	for( quint64 seq = d_first; seq < d_next; seq++ )
+		out << at( seq ).d_time.toString( "hh:mm:ss.zzz" ) << " " << format( at( seq ) ) << endl;
+	for( int i = 0; i < d_pending.size(); i++ )
+		out << d_pending[i].d_time.toString( "hh:mm:ss.zzz" ) << " " << format( d_pending[i] ) << endl;
+	return f.error() == QFile::NoError;
+}
+
+QString LogModel::format( const Record& r )
+{
+	switch( r.d_kind )
+	{
+	case 0:
+		return ">>> " + r.d_text;
+	case 1:
+		return "*** " + r.d_text;
+	case 2:
+		return "### " + r.d_text;
+	}
+	return r.d_text;
+}
+
+int LogModel::rowCount( const QModelIndex& parent ) const
+{
+	if( parent.isValid() )
+		return 0;
+	return d_rows.size();
+}
+
+QVariant LogModel::data( const QModelIndex& index, int role ) const
+{
+	if( !index.isValid() || index.row() >= d_rows.size() )
+		return QVariant();
+	const Record& r = at( d_rows[ index.row() ] );
+	switch( role )
+	{
+	case Qt::DisplayRole:
+		return format( r );
+	case Qt::ToolTipRole:
+		return r.d_time.toString( "hh:mm:ss.zzz" );
+	}
+	return QVariant();
+}
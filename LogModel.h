@@ -0,0 +1,68 @@
+#ifndef LOGMODEL_H
+#define LOGMODEL_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QAbstractListModel>
+#include <QVector>
+#include <QList>
+#include <QTime>
+
+class QTimer;
+
+// The log window's records in a ring buffer of fixed capacity (LogCapacity, default 100000);
+// the oldest records are dropped. New records are collected and shown by a timer in
+// batches, so a flood of trace messages doesn't relayout the view for each of them.
+// Only the records of at least the minimum kind are rows of the model.
+class LogModel : public QAbstractListModel
+{
+	Q_OBJECT
+public:
+	LogModel( QObject* parent = 0 );
+
+	void append( const QString& text, int kind ); // kind see DoorScopeEtl::LogKind
+	void clear();
+	void setMinKind( int );
+	int getMinKind() const { return d_minKind; }
+	// Writes all records in the buffer, regardless of the minimum kind
+	bool save( const QString& path ) const;
+
+	// Overrides
+	int rowCount( const QModelIndex& parent = QModelIndex() ) const;
+	QVariant data( const QModelIndex& index, int role = Qt::DisplayRole ) const;
+protected slots:
+	void onFlush();
+private:
+	struct Record
+	{
+		QString d_text;
+		QTime d_time;
+		int d_kind;
+		Record( const QString& t = QString(), int k = 0 ):d_text(t),d_time(QTime::currentTime()),d_kind(k) {}
+	};
+	const Record& at( quint64 seq ) const { return d_ring[ seq % d_ring.size() ]; }
+	static QString format( const Record& );
+	QVector<Record> d_ring;
+	quint64 d_first; // sequence number of the oldest record in d_ring
+	quint64 d_next; // sequence number of the next record
+	QList<quint64> d_rows; // sequence numbers of the records shown
+	QList<Record> d_pending; // not yet in d_ring
+	QTimer* d_timer;
+	int d_minKind;
+};
+
+#endif // LOGMODEL_H
@@ -0,0 +1,199 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "Metrics.h"
+#include <Stream/DataCell.h>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+void Metrics::reset()
+{
+	d_bytesReceived = 0;
+	for( int i = 0; i < MaxCommand; i++ )
+		d_commands[i] = 0;
+	for( int i = 0; i < MaxCellType; i++ )
+		d_cells[i] = 0;
+	d_objects = 0;
+	d_images = 0;
+	d_imageBytes = 0;
+	d_maxEmbedDepth = 0;
+	for( int i = 0; i < MaxPhase; i++ )
+		d_ns[i] = 0;
+	d_opened = 0;
+	d_liveBytes = 0;
+	d_liveObjects = 0;
+	d_liveImages = 0;
+}
+
+void Metrics::add( const Metrics& rhs )
+{
+	d_bytesReceived += rhs.d_bytesReceived;
+	for( int i = 0; i < MaxCommand; i++ )
+		d_commands[i] += rhs.d_commands[i];
+	for( int i = 0; i < MaxCellType; i++ )
+		d_cells[i] += rhs.d_cells[i];
+	d_objects += rhs.d_objects;
+	d_images += rhs.d_images;
+	d_imageBytes += rhs.d_imageBytes;
+	enterEmbed( rhs.d_maxEmbedDepth );
+	for( int i = 0; i < MaxPhase; i++ )
+		d_ns[i] += rhs.d_ns[i];
+	d_liveBytes.fetchAndAddRelaxed( rhs.d_liveBytes );
+	d_liveObjects.fetchAndAddRelaxed( rhs.d_liveObjects );
+	d_liveImages.fetchAndAddRelaxed( rhs.d_liveImages );
+}
+
+void Metrics::copyParserCounters( const Metrics& rhs )
+{
+	d_bytesReceived = rhs.d_bytesReceived;
+	for( int i = 0; i < MaxCommand; i++ )
+		d_commands[i] = rhs.d_commands[i];
+	d_ns[Parse] = rhs.d_ns[Parse];
+}
+
+void Metrics::copyAgentCounters( const Metrics& rhs )
+{
+	for( int i = 0; i < MaxCellType; i++ )
+		d_cells[i] = rhs.d_cells[i];
+	d_objects = rhs.d_objects;
+	d_images = rhs.d_images;
+	d_imageBytes = rhs.d_imageBytes;
+	d_maxEmbedDepth = rhs.d_maxEmbedDepth;
+	d_ns[Image] = rhs.d_ns[Image];
+	d_ns[Write] = rhs.d_ns[Write];
+	d_opened = rhs.d_opened;
+}
+
+quint64 Metrics::now()
+{
+#ifdef Q_OS_WIN
+	static LARGE_INTEGER freq = { 0 };
+	if( freq.QuadPart == 0 )
+		QueryPerformanceFrequency( &freq );
+	LARGE_INTEGER t;
+	QueryPerformanceCounter( &t );
+	return quint64( double( t.QuadPart ) * 1000000000.0 / double( freq.QuadPart ) );
+#else
+	timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return quint64( t.tv_sec ) * 1000000000 + t.tv_nsec;
+#endif
+}
+
+void Metrics::writeJson( QByteArray& out ) const
+{
+	out += "\"bytes\":" + QByteArray::number( d_bytesReceived );
+	out += ",\"cells\":{";
+	bool first = true;
+	for( int i = 0; i < MaxCellType; i++ )
+	{
+		if( d_cells[i] == 0 )
+			continue;
+		if( !first )
+			out += ',';
+		first = false;
+		out += '"';
+		out += Stream::DataCell::typePrettyName[i];
+		out += "\":" + QByteArray::number( d_cells[i] );
+	}
+	out += "},\"objects\":" + QByteArray::number( d_objects );
+	out += ",\"images\":" + QByteArray::number( d_images );
+	out += ",\"imageBytes\":" + QByteArray::number( d_imageBytes );
+	out += ",\"maxEmbedDepth\":" + QByteArray::number( d_maxEmbedDepth );
+	out += ",\"ms\":{\"parse\":" + QByteArray::number( d_ns[Parse] / 1000000 );
+	out += ",\"image\":" + QByteArray::number( d_ns[Image] / 1000000 );
+	out += ",\"write\":" + QByteArray::number( d_ns[Write] / 1000000 ) + "}";
+}
+
+QByteArray Metrics::jsonString( const QString& str )
+{
+	QByteArray res = "\"";
+	const QByteArray utf8 = str.toUtf8();
+	for( int i = 0; i < utf8.size(); i++ )
+	{
+		const char ch = utf8[i];
+		if( ch == '"' || ch == '\\' )
+		{
+			res += '\\';
+			res += ch;
+		}else if( quint8(ch) < 0x20 )
+			res += ' ';
+		else
+			res += ch;
+	}
+	res += '"';
+	return res;
+}
+
+void TimingReport::reset()
+{
+	d_phases.clear();
+	d_last.clear();
+	d_lastClock = 0;
+	d_lastEtl = 0;
+	d_lastAt = 0;
+}
+
+void TimingReport::mark( const QString& name, int clock, quint64 etlNs )
+{
+	const quint64 now = Metrics::now();
+	if( !d_last.isEmpty() )
+	{
+		Phase& p = d_phases[d_last];
+		p.d_count++;
+		// The DOORS tick count wraps after 49 days; a negative difference is ignored
+		if( clock >= d_lastClock )
+			p.d_dxlMs += clock - d_lastClock;
+		p.d_etlNs += etlNs - d_lastEtl;
+		p.d_wallNs += now - d_lastAt;
+	}
+	d_last = name;
+	d_lastClock = clock;
+	d_lastEtl = etlNs;
+	d_lastAt = now;
+}
+
+void TimingReport::writeJson( QByteArray& out ) const
+{
+	out += "\"marks\":{";
+	QMap<QString,Phase>::const_iterator i;
+	for( i = d_phases.begin(); i != d_phases.end(); ++i )
+	{
+		if( i != d_phases.begin() )
+			out += ',';
+		out += Metrics::jsonString( i.key() ) + ":{\"count\":" + QByteArray::number( i.value().d_count );
+		out += ",\"dxlMs\":" + QByteArray::number( i.value().d_dxlMs );
+		out += ",\"etlMs\":" + QByteArray::number( i.value().d_etlNs / 1000000 );
+		out += ",\"wallMs\":" + QByteArray::number( i.value().d_wallNs / 1000000 ) + "}";
+	}
+	out += "}";
+}
+
+QStringList TimingReport::toLines() const
+{
+	QStringList res;
+	QMap<QString,Phase>::const_iterator i;
+	for( i = d_phases.begin(); i != d_phases.end(); ++i )
+	{
+		res << QString( "%1: %2 times, DXL %3 ms, ETL %4 ms, wall %5 ms" ).arg( i.key() ).
+			arg( i.value().d_count ).arg( i.value().d_dxlMs ).arg( i.value().d_etlNs / 1000000 ).
+			arg( i.value().d_wallNs / 1000000 );
+	}
+	return res;
+}
@@ -0,0 +1,108 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QString>
+#include <QMap>
+#include <QStringList>
+#include <QAtomicInt>
+
+// Plain counters of one connection resp. one StreamAgent. There are no locks nor signals
+// involved, so updating them is cheap enough for the hot path. The parser counters
+// (d_bytesReceived, d_commands, d_ns[Parse]) are written by the thread parsing the
+// connection, all others by the thread owning the agent; with the Pipeline these are two
+// threads, see IpcProtocol::snapshot. The progress shown by the Dashboard is in addition
+// kept in the atomic d_live counters, which any thread may read without a snapshot.
+class Metrics
+{
+public:
+	enum { MaxCommand = 64, MaxCellType = 64 };
+	enum Phase { Parse, Image, Write, MaxPhase };
+
+	Metrics() { reset(); }
+	void reset();
+
+	// Monotonic clock in nanoseconds
+	static quint64 now();
+
+	void addTime( Phase p, quint64 start ) { d_ns[p] += now() - start; }
+	void enterEmbed( int depth ) { if( depth > d_maxEmbedDepth ) d_maxEmbedDepth = depth; }
+	void addObject() { d_objects++; d_liveObjects.ref(); }
+	void addImage() { d_images++; d_liveImages.ref(); }
+	// Adds the counters and times of e.g. a section written by another agent; d_opened is kept
+	void add( const Metrics& );
+	void copyParserCounters( const Metrics& );
+	void copyAgentCounters( const Metrics& );
+
+	// Appends the common part as JSON members (without braces)
+	void writeJson( QByteArray& out ) const;
+	static QByteArray jsonString( const QString& );
+
+	quint64 d_bytesReceived;
+	quint64 d_commands[MaxCommand];
+	quint64 d_cells[MaxCellType];
+	quint64 d_objects; // obj frames
+	quint64 d_images;
+	quint64 d_imageBytes;
+	int d_maxEmbedDepth;
+	quint64 d_ns[MaxPhase];
+	quint64 d_opened; // now() at OpenStream, 0 if no stream is open
+
+	// 32 bit, i.e. d_liveBytes wraps after 4 GB; reset together with the others
+	QAtomicInt d_liveBytes; // added once per IpcProtocol::parse call
+	QAtomicInt d_liveObjects;
+	QAtomicInt d_liveImages;
+};
+
+// Pairs the Mark commands of the DXL script with the time the agent spent in between.
+// A mark names the phase which starts there and carries the DOORS clock in ms; a phase
+// lasts up to the next mark. So per phase the DXL time (clock difference), the ETL
+// time (agent write and image time) and the wall time as seen by the ETL add up.
+class TimingReport
+{
+public:
+	TimingReport() { reset(); }
+	void reset();
+	// etlNs: agent time so far, i.e. Metrics::d_ns[Write] + d_ns[Image]
+	void mark( const QString& name, int clock, quint64 etlNs );
+	// Ends the open phase at the end of the stream; it gets no DXL time
+	void finish( quint64 etlNs ) { if( !d_last.isEmpty() ) mark( QString(), d_lastClock, etlNs ); }
+	bool isEmpty() const { return d_phases.isEmpty(); }
+
+	// Appends the phases as a JSON object member (without braces)
+	void writeJson( QByteArray& out ) const;
+	QStringList toLines() const; // one line per phase for the log
+private:
+	struct Phase
+	{
+		quint64 d_count;
+		qint64 d_dxlMs;
+		quint64 d_etlNs;
+		quint64 d_wallNs;
+		Phase():d_count(0),d_dxlMs(0),d_etlNs(0),d_wallNs(0) {}
+	};
+	QMap<QString,Phase> d_phases;
+	QString d_last; // the open phase, empty if none
+	int d_lastClock;
+	quint64 d_lastEtl;
+	quint64 d_lastAt;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,449 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "OutputSink.h"
+#include "Metrics.h"
+#include "Publisher.h"
+#include <QSettings>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <Stream/Exceptions.h>
+
+// With a StagingDir the file is written there and target is set to its place in OutDir
+static QString outPath( const QString& name, const char* suffix, QString& target )
+{
+	return Publisher::stagedPath( name + suffix, target );
+}
+
+OutputSink* OutputSink::create( const QString& kind )
+{
+	const QString k = kind.trimmed().toLower();
+	if( k == "dsdx" )
+		return new DsdxSink();
+	if( k == "jsonl" )
+		return new TableSink( false );
+	if( k == "csv" )
+		return new TableSink( true );
+	if( k == "null" )
+		return new NullSink();
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+DsdxSink::~DsdxSink()
+{
+	delete d_dict;
+}
+
+bool DsdxSink::open( const QString& name, QString& error )
+{
+	QFile* f = new QFile( outPath( name, ".dsdx", d_target ) );
+	if( !f->open( QIODevice::WriteOnly | QIODevice::Unbuffered ) )
+	{
+		error = "cannot open " + f->fileName() + " for writing";
+		delete f;
+		return false;
+	}
+	d_path = f->fileName();
+	d_out.setDevice( f, true );
+	QSettings set;
+	if( set.value( "DictionaryEncoding", false ).toBool() )
+	{
+		if( d_dict == 0 )
+			d_dict = new StreamDictionary::Encoder();
+		d_dict->reset();
+		d_dict->writeHeader( d_out );
+	}
+	return true;
+}
+
+qint64 DsdxSink::getSize() const
+{
+	// Stat by path; the file object may be in use by an AsyncSink thread
+	return ( d_path.isEmpty() ) ? -1 : QFileInfo( d_path ).size();
+}
+
+void DsdxSink::writeSlot( const QByteArray& name, const Stream::DataCell& value )
+{
+	if( d_dict )
+		d_dict->writeSlot( d_out, name, value );
+	else if( name.isEmpty() )
+		d_out.writeSlot( value );
+	else
+		d_out.writeSlot( value, name.data(), true );
+}
+
+void DsdxSink::startFrame( const QByteArray& name )
+{
+	if( name.isNull() )
+		d_out.startFrame();
+	else
+		d_out.startFrame( name.data() );
+}
+
+void DsdxSink::endFrame()
+{
+	d_out.endFrame();
+}
+
+void DsdxSink::close()
+{
+	d_out.setDevice( 0 );
+	if( !d_target.isEmpty() )
+		Publisher::instance()->publish( d_path, d_target );
+	d_target.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+static QString cellText( const Stream::DataCell& v )
+{
+	switch( v.getType() )
+	{
+	case Stream::DataCell::TypeBml:
+	case Stream::DataCell::TypeImg:
+		return QString( "<%1>" ).arg( QString::fromLatin1( Stream::DataCell::typePrettyName[v.getType()] ) );
+	default:
+		return v.toString();
+	}
+}
+
+static QByteArray csvField( const QString& str )
+{
+	QByteArray res = str.toUtf8();
+	if( res.contains( ',' ) || res.contains( '"' ) || res.contains( '\n' ) || res.contains( '\r' ) )
+	{
+		res.replace( "\"", "\"\"" );
+		res = "\"" + res + "\"";
+	}
+	return res;
+}
+
+bool TableSink::open( const QString& name, QString& error )
+{
+	d_path = outPath( name, ( d_csv ) ? ".csv" : ".jsonl", d_target );
+	d_file.setFileName( d_path );
+	if( !d_file.open( QIODevice::WriteOnly ) )
+	{
+		error = "cannot open " + d_file.fileName() + " for writing";
+		return false;
+	}
+	if( d_csv )
+		d_file.write( "row,frame,attribute,type,value\n" );
+	d_rows = 0;
+	d_stack.clear();
+	d_stack.append( Row() ); // top level, e.g. the export header
+	return true;
+}
+
+void TableSink::writeSlot( const QByteArray& name, const Stream::DataCell& value )
+{
+	if( !name.isEmpty() && !d_stack.isEmpty() )
+		d_stack.back().d_atts.append( qMakePair( name, value ) );
+}
+
+void TableSink::startFrame( const QByteArray& name )
+{
+	d_stack.append( Row() );
+	d_stack.back().d_frame = name;
+}
+
+void TableSink::endFrame()
+{
+	if( d_stack.size() <= 1 )
+		return;
+	writeRow( d_stack.back() );
+	d_stack.pop_back();
+}
+
+void TableSink::writeRow( const Row& r )
+{
+	if( r.d_atts.isEmpty() )
+		return;
+	d_rows++;
+	if( d_csv )
+	{
+		for( int i = 0; i < r.d_atts.size(); i++ )
+		{
+			const Stream::DataCell& v = r.d_atts[i].second;
+			d_file.write( QByteArray::number( d_rows ) + "," + r.d_frame + "," +
+				csvField( QString::fromLatin1( r.d_atts[i].first ) ) + "," +
+				Stream::DataCell::typePrettyName[v.getType()] + "," + csvField( cellText( v ) ) + "\n" );
+		}
+	}else
+	{
+		QByteArray line = "{\"frame\":" + Metrics::jsonString( QString::fromLatin1( r.d_frame ) ) +
+			",\"depth\":" + QByteArray::number( d_stack.size() - 1 );
+		for( int i = 0; i < r.d_atts.size(); i++ )
+		{
+			const Stream::DataCell& v = r.d_atts[i].second;
+			line += "," + Metrics::jsonString( QString::fromLatin1( r.d_atts[i].first ) ) + ":";
+			switch( v.getType() )
+			{
+			case Stream::DataCell::TypeUInt8:
+			case Stream::DataCell::TypeInt32:
+			case Stream::DataCell::TypeDouble:
+				line += v.toString().toLatin1();
+				break;
+			case Stream::DataCell::TypeTrue:
+				line += "true";
+				break;
+			case Stream::DataCell::TypeFalse:
+				line += "false";
+				break;
+			default:
+				line += Metrics::jsonString( cellText( v ) );
+				break;
+			}
+		}
+		line += "}\n";
+		d_file.write( line );
+	}
+}
+
+void TableSink::close()
+{
+	// Frames left open at the end are written as well
+	while( d_stack.size() > 1 )
+		endFrame();
+	if( !d_stack.isEmpty() )
+		writeRow( d_stack.back() );
+	d_stack.clear();
+	d_file.close();
+	if( !d_target.isEmpty() )
+		Publisher::instance()->publish( d_path, d_target );
+	d_target.clear();
+}
+
+QString TableSink::getSummary() const
+{
+	return QString( "%1 (%2 rows)" ).arg( d_path ).arg( d_rows );
+}
+
+qint64 TableSink::getSize() const
+{
+	return ( d_path.isEmpty() ) ? -1 : QFileInfo( d_path ).size();
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+NullSink::NullSink():d_out(0),d_frames(0),d_slots(0)
+{
+}
+
+bool NullSink::open( const QString&, QString& )
+{
+	d_dev.open( QIODevice::WriteOnly );
+	d_dev.d_bytes = 0;
+	d_frames = 0;
+	d_slots = 0;
+	d_out.setDevice( &d_dev, false );
+	return true;
+}
+
+void NullSink::writeSlot( const QByteArray& name, const Stream::DataCell& value )
+{
+	d_slots++;
+	if( name.isEmpty() )
+		d_out.writeSlot( value );
+	else
+		d_out.writeSlot( value, name.data(), true );
+}
+
+void NullSink::startFrame( const QByteArray& name )
+{
+	d_frames++;
+	if( name.isNull() )
+		d_out.startFrame();
+	else
+		d_out.startFrame( name.data() );
+}
+
+void NullSink::endFrame()
+{
+	d_out.endFrame();
+}
+
+void NullSink::close()
+{
+	d_out.setDevice( 0 );
+	d_dev.close();
+}
+
+QString NullSink::getSummary() const
+{
+	return QString( "null sink: %1 frames, %2 slots, %3 bytes" ).arg( d_frames ).arg( d_slots ).
+		arg( d_dev.d_bytes );
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+void RecordingSink::writeSlot( const QByteArray& name, const Stream::DataCell& value )
+{
+	if( value.getType() == Stream::DataCell::TypeBml || value.getType() == Stream::DataCell::TypeImg )
+		d_bytes += value.getArr().size();
+	d_ops.append( Op( Slot, name, value ) );
+}
+
+void RecordingSink::startFrame( const QByteArray& name )
+{
+	d_ops.append( Op( StartFrame, name ) );
+}
+
+void RecordingSink::endFrame()
+{
+	d_ops.append( Op( EndFrame ) );
+}
+
+void RecordingSink::replay( OutputSink* to ) const
+{
+	for( int i = 0; i < d_ops.size(); i++ )
+	{
+		const Op& op = d_ops[i];
+		switch( op.d_kind )
+		{
+		case Slot:
+			to->writeSlot( op.d_name, op.d_value );
+			break;
+		case StartFrame:
+			to->startFrame( op.d_name );
+			break;
+		case EndFrame:
+			to->endFrame();
+			break;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+AsyncSink::AsyncSink( OutputSink* sink, int maxQueue, qint64 maxBytes ):d_sink(sink),d_maxQueue(maxQueue),
+	d_maxBytes(maxBytes),d_queuedBytes(0)
+{
+}
+
+AsyncSink::~AsyncSink()
+{
+	if( isRunning() )
+	{
+		enqueue( Op( Close ) );
+		wait();
+	}
+	delete d_sink;
+}
+
+bool AsyncSink::open( const QString& name, QString& error )
+{
+	// Opened on the caller's thread so that errors are reported synchronously
+	if( !d_sink->open( name, error ) )
+		return false;
+	d_error.clear();
+	start();
+	return true;
+}
+
+void AsyncSink::enqueue( const Op& op )
+{
+	QMutexLocker lock( &d_lock );
+	// An op larger than d_maxBytes still gets through once the queue is empty
+	while( !d_queue.isEmpty() && ( d_queue.size() >= d_maxQueue || d_queuedBytes + op.d_bytes > d_maxBytes ) )
+		d_notFull.wait( &d_lock );
+	d_queue.enqueue( op );
+	d_queuedBytes += op.d_bytes;
+	d_notEmpty.wakeOne();
+}
+
+void AsyncSink::writeSlot( const QByteArray& name, const Stream::DataCell& value )
+{
+	enqueue( Op( Slot, name, value ) );
+}
+
+void AsyncSink::startFrame( const QByteArray& name )
+{
+	enqueue( Op( StartFrame, name ) );
+}
+
+void AsyncSink::endFrame()
+{
+	enqueue( Op( EndFrame ) );
+}
+
+void AsyncSink::close()
+{
+	enqueue( Op( Close ) );
+	wait();
+}
+
+QString AsyncSink::getError()
+{
+	QMutexLocker lock( &d_lock );
+	const QString res = d_error;
+	d_error.clear();
+	return res;
+}
+
+void AsyncSink::run()
+{
+	forever
+	{
+		d_lock.lock();
+		while( d_queue.isEmpty() )
+			d_notEmpty.wait( &d_lock );
+		const Op op = d_queue.dequeue();
+		d_queuedBytes -= op.d_bytes;
+		d_notFull.wakeOne();
+		d_lock.unlock();
+
+		try
+		{
+			switch( op.d_kind )
+			{
+			case Slot:
+				d_sink->writeSlot( op.d_name, op.d_value );
+				break;
+			case StartFrame:
+				d_sink->startFrame( op.d_name );
+				break;
+			case EndFrame:
+				d_sink->endFrame();
+				break;
+			case Close:
+				d_sink->close();
+				break;
+			}
+		}catch( Stream::StreamException& e )
+		{
+			QMutexLocker lock( &d_lock );
+			if( d_error.isEmpty() ) // only the first one, the rest is usually a consequence
+				d_error = QString( "%1 %2" ).arg( e.getCode() ).arg( QString( e.getMsg() ) );
+		}catch( std::exception& e )
+		{
+			QMutexLocker lock( &d_lock );
+			if( d_error.isEmpty() ) // only the first one, the rest is usually a consequence
+				d_error = e.what();
+		}catch( ... )
+		{
+			QMutexLocker lock( &d_lock );
+			if( d_error.isEmpty() )
+				d_error = "unknown exception";
+		}
+		// Also if close threw; nothing is queued anymore and close() waits for us
+		if( op.d_kind == Close )
+			return;
+	}
+}
@@ -0,0 +1,205 @@
+#ifndef OUTPUTSINK_H
+#define OUTPUTSINK_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+#include <QFile>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <Stream/DataWriter.h>
+#include "StreamDictionary.h"
+
+// Receiver of the top level stream of a StreamAgent. The agent fans out each slot and
+// frame to all configured sinks; embedded streams are still assembled in memory and
+// arrive here as a single Bml cell. Sink methods may throw; the agent catches.
+class OutputSink
+{
+public:
+	virtual ~OutputSink() {}
+	virtual bool open( const QString& name, QString& error ) = 0; // name is the module name
+	virtual void writeSlot( const QByteArray& name, const Stream::DataCell& value ) = 0;
+	virtual void startFrame( const QByteArray& name ) = 0;
+	virtual void endFrame() = 0;
+	virtual void close() = 0;
+	virtual QString getSummary() const { return QString(); } // reported after close
+	virtual QString getError() { return QString(); } // errors which couldn't be thrown
+	virtual qint64 getSize() const { return -1; } // bytes on disk so far; may be called from another thread
+	virtual bool isAsync() const { return false; }
+
+	// kind: dsdx, jsonl, csv or null
+	static OutputSink* create( const QString& kind );
+};
+
+// The original .dsdx file in OutDir resp. StagingDir, see Publisher. With the DictionaryEncoding setting the top level
+// slots are written through a StreamDictionary::Encoder; embeds are not affected.
+class DsdxSink : public OutputSink
+{
+public:
+	DsdxSink():d_out(0),d_dict(0) {}
+	~DsdxSink();
+	bool open( const QString& name, QString& error );
+	void writeSlot( const QByteArray& name, const Stream::DataCell& value );
+	void startFrame( const QByteArray& name );
+	void endFrame();
+	void close();
+	QString getSummary() const { return d_path; }
+	qint64 getSize() const;
+private:
+	Stream::DataWriter d_out;
+	StreamDictionary::Encoder* d_dict;
+	QString d_path;
+	QString d_target; // in OutDir if d_path is staged
+};
+
+// Flat attribute table in OutDir; one row per frame with its named slots (jsonl)
+// resp. one line per named slot (csv). Bml and image cells are only noted by type.
+class TableSink : public OutputSink
+{
+public:
+	TableSink( bool csv ):d_csv(csv),d_rows(0) {}
+	bool open( const QString& name, QString& error );
+	void writeSlot( const QByteArray& name, const Stream::DataCell& value );
+	void startFrame( const QByteArray& name );
+	void endFrame();
+	void close();
+	QString getSummary() const;
+	qint64 getSize() const;
+private:
+	struct Row
+	{
+		QByteArray d_frame;
+		QList< QPair<QByteArray,Stream::DataCell> > d_atts;
+	};
+	void writeRow( const Row& );
+	QFile d_file;
+	QString d_path;
+	QString d_target; // in OutDir if d_path is staged
+	QList<Row> d_stack;
+	bool d_csv;
+	quint64 d_rows;
+};
+
+// Serializes to nowhere; counts frames, slots and bytes. For benchmarks without disk.
+class NullSink : public OutputSink
+{
+public:
+	NullSink();
+	bool open( const QString& name, QString& error );
+	void writeSlot( const QByteArray& name, const Stream::DataCell& value );
+	void startFrame( const QByteArray& name );
+	void endFrame();
+	void close();
+	QString getSummary() const;
+private:
+	class Counter : public QIODevice
+	{
+	public:
+		Counter():d_bytes(0) {}
+		bool isSequential() const { return true; }
+		quint64 d_bytes;
+	protected:
+		qint64 readData( char*, qint64 ) { return -1; }
+		qint64 writeData( const char*, qint64 len ) { d_bytes += len; return len; }
+	};
+	Counter d_dev;
+	Stream::DataWriter d_out;
+	quint64 d_frames;
+	quint64 d_slots;
+};
+
+// Keeps the top level stream in memory until it is replayed into other sinks; used for the
+// sections HtmlImporter writes in parallel. Embeds arrive as Bml cells, so a recording
+// holds the complete BML of the section.
+class RecordingSink : public OutputSink
+{
+public:
+	RecordingSink():d_bytes(0) {}
+	bool open( const QString&, QString& ) { d_ops.clear(); d_bytes = 0; return true; }
+	void writeSlot( const QByteArray& name, const Stream::DataCell& value );
+	void startFrame( const QByteArray& name );
+	void endFrame();
+	void close() {}
+	qint64 getSize() const { return d_bytes; }
+	bool isAsync() const { return true; } // cells outlive the call, spilled embeds must be copied
+	void replay( OutputSink* ) const;
+private:
+	enum Kind { Slot, StartFrame, EndFrame };
+	struct Op
+	{
+		Kind d_kind;
+		QByteArray d_name;
+		Stream::DataCell d_value;
+		Op( Kind k, const QByteArray& n = QByteArray(), const Stream::DataCell& v = Stream::DataCell() ):
+			d_kind(k),d_name(n),d_value(v) {}
+	};
+	QList<Op> d_ops;
+	qint64 d_bytes; // Bml and image payload only, a rough figure
+};
+
+// Runs another sink on its own thread so that a slow sink doesn't stall the agent
+// nor the other sinks. The queue is bounded by the number of ops and by the Bml and image
+// bytes it holds; a full queue blocks the producer.
+class AsyncSink : public QThread, public OutputSink
+{
+public:
+	AsyncSink( OutputSink* sink, int maxQueue = 4096, qint64 maxBytes = 64 * 1024 * 1024 );
+	~AsyncSink();
+	bool open( const QString& name, QString& error );
+	void writeSlot( const QByteArray& name, const Stream::DataCell& value );
+	void startFrame( const QByteArray& name );
+	void endFrame();
+	void close();
+	QString getSummary() const { return d_sink->getSummary(); }
+	qint64 getSize() const { return d_sink->getSize(); }
+	QString getError();
+	bool isAsync() const { return true; }
+protected:
+	void run();
+private:
+	enum Kind { Slot, StartFrame, EndFrame, Close };
+	struct Op
+	{
+		Kind d_kind;
+		QByteArray d_name;
+		Stream::DataCell d_value;
+		qint64 d_bytes; // payload of Bml and image cells
+		Op( Kind k, const QByteArray& n = QByteArray(), const Stream::DataCell& v = Stream::DataCell() ):
+			d_kind(k),d_name(n),d_value(v),d_bytes(0)
+		{
+			if( v.getType() == Stream::DataCell::TypeBml || v.getType() == Stream::DataCell::TypeImg )
+				d_bytes = v.getArr().size();
+		}
+	};
+	void enqueue( const Op& );
+	OutputSink* d_sink;
+	QQueue<Op> d_queue;
+	QMutex d_lock;
+	QWaitCondition d_notEmpty;
+	QWaitCondition d_notFull;
+	QString d_error;
+	int d_maxQueue;
+	qint64 d_maxBytes;
+	qint64 d_queuedBytes;
+};
+
+#endif // OUTPUTSINK_H
@@ -0,0 +1,83 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "Pipeline.h"
+#include <QMutexLocker>
+
+Pipeline::Pipeline( IpcProtocol* p, int capacity ):d_ring( capacity ),d_proto( p ),d_pushed( 0 )
+{
+	start();
+}
+
+Pipeline::~Pipeline()
+{
+	d_quit.fetchAndStoreOrdered( 1 );
+	d_lock.lock();
+	d_wake.wakeOne();
+	d_lock.unlock();
+	wait();
+}
+
+bool Pipeline::push( const IpcProtocol::Record& r )
+{
+	if( !d_ring.push( r ) )
+		return false;
+	d_pushed++;
+	// Full barrier, pairs with the writer setting d_sleeping before it checks the ring
+	if( d_sleeping.fetchAndAddOrdered( 0 ) )
+	{
+		QMutexLocker lock( &d_lock );
+		d_wake.wakeOne();
+	}
+	return true;
+}
+
+void Pipeline::pushWait( const IpcProtocol::Record& r )
+{
+	while( !push( r ) )
+		QThread::yieldCurrentThread();
+}
+
+void Pipeline::waitForIdle()
+{
+	while( d_applied.fetchAndAddAcquire( 0 ) != d_pushed )
+		QThread::yieldCurrentThread();
+}
+
+void Pipeline::run()
+{
+	forever
+	{
+		IpcProtocol::Record* r = d_ring.front();
+		if( r == 0 )
+		{
+			if( d_quit.fetchAndAddAcquire( 0 ) )
+				return; // drained
+			d_proto->publish();
+			QMutexLocker lock( &d_lock );
+			d_sleeping.fetchAndStoreOrdered( 1 );
+			if( d_ring.front() == 0 && !d_quit.fetchAndAddAcquire( 0 ) )
+				d_wake.wait( &d_lock, 100 ); // the timeout covers a missed wakeup
+			d_sleeping.fetchAndStoreOrdered( 0 );
+			continue;
+		}
+		d_proto->apply( *r );
+		d_ring.pop();
+		// The GUI only sees the counters published here, see IpcProtocol::snapshot
+		if( ( d_applied.fetchAndAddRelease( 1 ) & 0xff ) == 0xff )
+			d_proto->publish();
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QWaitCondition>
+#include "IpcProtocol.h"
+
+// Bounded lock-free ring for exactly one producer and one consumer thread. Each side
+// only writes its own index; the other index is read with acquire semantics.
+template<class T>
+class SpscRing
+{
+public:
+	SpscRing( int capacity ):d_head(0),d_tail(0)
+	{
+		d_size = 1;
+		while( d_size < capacity )
+			d_size <<= 1;
+		d_mask = d_size - 1;
+		d_data = new T[d_size];
+	}
+	~SpscRing() { delete[] d_data; }
+
+	// Producer; false if full
+	bool push( const T& v )
+	{
+		const quint32 head = int( d_head );
+		if( head - quint32( d_tail.fetchAndAddAcquire( 0 ) ) >= d_size )
+			return false;
+		d_data[head & d_mask] = v;
+		d_head.fetchAndStoreRelease( head + 1 );
+		return true;
+	}
+	// Consumer; 0 if empty. The element stays valid until pop().
+	T* front()
+	{
+		const quint32 tail = int( d_tail );
+		if( quint32( d_head.fetchAndAddAcquire( 0 ) ) == tail )
+			return 0;
+		return &d_data[tail & d_mask];
+	}
+	void pop()
+	{
+		d_tail.fetchAndStoreRelease( int( d_tail ) + 1 );
+	}
+	bool isEmpty() const { return int( d_head ) == int( d_tail ); }
+private:
+	Q_DISABLE_COPY(SpscRing)
+	T* d_data;
+	quint32 d_size;
+	quint32 d_mask;
+	QAtomicInt d_head; // next to write
+	QAtomicInt d_tail; // next to read
+};
+
+// Writer thread of a pipelined IpcProtocol: the protocol parses on the socket's thread
+// and pushes the decoded records; this thread applies them to the StreamAgent.
+class Pipeline : public QThread
+{
+public:
+	Pipeline( IpcProtocol*, int capacity );
+	~Pipeline(); // applies the remaining records and stops the thread
+
+	bool push( const IpcProtocol::Record& ); // false if full; retry later
+	void pushWait( const IpcProtocol::Record& ); // blocks until there is room
+	void waitForIdle(); // returns when all pushed records are applied
+protected:
+	void run();
+private:
+	SpscRing<IpcProtocol::Record> d_ring;
+	IpcProtocol* d_proto;
+	QAtomicInt d_sleeping;
+	QAtomicInt d_quit;
+	QAtomicInt d_applied;
+	int d_pushed; // only used by the producer
+	QMutex d_lock; // only for sleeping and waking the writer
+	QWaitCondition d_wake;
+};
+
+#endif // PIPELINE_H
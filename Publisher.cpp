@@ -0,0 +1,221 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+#include "Publisher.h"
+#include "DoorScopeEtl.h"
+#include <QRunnable>
+#include <QSettings>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QWaitCondition>
+#include <QMutexLocker>
+#include <QCoreApplication>
+#include <QAtomicInt>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <stdio.h>
+#endif
+
+static const int s_firstRetryDelay = 500; // ms, doubled with each attempt
+static QAtomicInt s_serial; // makes staged and part files unique within the process
+
+// Each sink gets its own file, so that a re-export or another worker process writing the
+// same name neither truncates a file being published nor gets its file removed by the job.
+static QString uniqueSuffix()
+{
+	return QString( ".%1-%2" ).arg( QCoreApplication::applicationPid() ).
+			arg( s_serial.fetchAndAddOrdered( 1 ) );
+}
+
+// Replaces an existing target in one step; readers see either the old or the new file
+static bool replaceFile( const QString& from, const QString& to )
+{
+#ifdef Q_OS_WIN
+	return ::MoveFileExW( (const wchar_t*)QDir::toNativeSeparators( from ).utf16(),
+						  (const wchar_t*)QDir::toNativeSeparators( to ).utf16(),
+						  MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH ) != 0;
+#else
+	return ::rename( QFile::encodeName( from ).constData(), QFile::encodeName( to ).constData() ) == 0;
+#endif
+}
+
+class PublishJob : public QRunnable
+{
+public:
+	PublishJob( Publisher* p, const QString& staged, const QString& target, int retries, quint64 serial ):
+		d_pub(p),d_staged(staged),d_target(target),d_retries(retries),d_serial(serial){}
+	void run();
+private:
+	Publisher::Replace attempt( QString& err );
+	Publisher* d_pub;
+	QString d_staged;
+	QString d_target;
+	int d_retries;
+	quint64 d_serial; // see Publisher::d_latest
+};
+
+void PublishJob::run()
+{
+	QString err;
+	int delay = s_firstRetryDelay;
+	for( int i = 0; i <= d_retries; i++ )
+	{
+		if( i > 0 )
+		{
+			// QThread::msleep is not public in Qt 4
+			QMutex m;
+			QWaitCondition w;
+			m.lock();
+			w.wait( &m, delay );
+			m.unlock();
+			delay *= 2;
+		}
+		const Publisher::Replace res = attempt( err );
+		if( res == Publisher::Replaced )
+		{
+			QFile::remove( d_staged );
+			d_pub->finished( d_target, d_serial );
+			d_pub->done( "Published " + d_target, DoorScopeEtl::LogStatus );
+			return;
+		}else if( res == Publisher::Superseded )
+		{
+			QFile::remove( d_staged );
+			d_pub->done( "Publisher: skipped " + d_target + ", a newer export replaces it",
+				DoorScopeEtl::LogStatus );
+			return;
+		}
+	}
+	d_pub->finished( d_target, d_serial );
+	d_pub->done( QString( "Publisher: giving up on %1, the file stays in %2: %3" ).
+		arg( d_target ).arg( d_staged ).arg( err ), DoorScopeEtl::LogError );
+}
+
+Publisher::Replace PublishJob::attempt( QString& err )
+{
+	if( d_pub->isSuperseded( d_target, d_serial ) )
+		return Publisher::Superseded; // don't copy in vain
+	const QString part = d_target + uniqueSuffix() + ".part";
+	QFile::remove( part );
+	if( !QFile::copy( d_staged, part ) )
+	{
+		err = "cannot copy to " + part;
+		return Publisher::Failed;
+	}
+	if( QFileInfo( part ).size() != QFileInfo( d_staged ).size() )
+	{
+		QFile::remove( part );
+		err = "incomplete copy " + part;
+		return Publisher::Failed;
+	}
+	const Publisher::Replace res = d_pub->replace( part, d_target, d_serial );
+	if( res != Publisher::Replaced )
+		QFile::remove( part );
+	if( res == Publisher::Failed )
+		err = "cannot rename " + part + " to " + d_target;
+	return res;
+}
+
+Publisher::Publisher():d_pending(0),d_serial(0)
+{
+	QSettings set;
+	d_pool.setMaxThreadCount( qMax( 1, set.value( "PublishThreads", 2 ).toInt() ) );
+}
+
+Publisher* Publisher::instance()
+{
+	static Publisher* s_inst = 0;
+	if( s_inst == 0 )
+		s_inst = new Publisher();
+	return s_inst;
+}
+
+QString Publisher::stagedPath( const QString& fileName, QString& target )
+{
+	QSettings set;
+	const QDir out( set.value( "OutDir", QDir::currentPath() ).toString() );
+	const QString staging = set.value( "StagingDir" ).toString();
+	if( staging.isEmpty() )
+	{
+		target.clear();
+		return out.absoluteFilePath( fileName );
+	}
+	target = out.absoluteFilePath( fileName );
+	QDir().mkpath( staging );
+	return QDir( staging ).absoluteFilePath( fileName + uniqueSuffix() );
+}
+
+void Publisher::publish( const QString& staged, const QString& target )
+{
+	QSettings set;
+	{
+		QMutexLocker lock( &d_lock );
+		d_pending++;
+	}
+	quint64 serial;
+	{
+		QMutexLocker lock( &d_targetsLock );
+		serial = ++d_serial;
+		d_latest[target] = serial;
+	}
+	d_pool.start( new PublishJob( this, staged, target, set.value( "PublishRetries", 5 ).toInt(), serial ) );
+}
+
+Publisher::Replace Publisher::replace( const QString& part, const QString& target, quint64 serial )
+{
+	// Checked and replaced under the lock, so that an older job can't replace the target
+	// after a newer one did
+	QMutexLocker lock( &d_targetsLock );
+	if( d_latest.value( target ) != serial )
+		return Superseded;
+	// QFile::rename doesn't replace an existing file
+	return ( replaceFile( part, target ) ) ? Replaced : Failed;
+}
+
+bool Publisher::isSuperseded( const QString& target, quint64 serial ) const
+{
+	QMutexLocker lock( &d_targetsLock );
+	return d_latest.value( target ) != serial;
+}
+
+void Publisher::finished( const QString& target, quint64 serial )
+{
+	QMutexLocker lock( &d_targetsLock );
+	if( d_latest.value( target ) == serial )
+		d_latest.remove( target );
+}
+
+void Publisher::done( const QString& msg, int kind )
+{
+	{
+		QMutexLocker lock( &d_lock );
+		d_pending--;
+	}
+	emit log( msg, kind );
+}
+
+int Publisher::getPending() const
+{
+	QMutexLocker lock( &d_lock );
+	return d_pending;
+}
+
+void Publisher::waitForDone()
+{
+	d_pool.waitForDone();
+}
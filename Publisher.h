@@ -0,0 +1,63 @@
+#ifndef PUBLISHER_H
+#define PUBLISHER_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QObject>
+#include <QThreadPool>
+#include <QMutex>
+#include <QHash>
+
+// Moves finished output files from the local staging directory (StagingDir setting) to
+// OutDir in the background, so that exports never wait on a network share and readers
+// never see half written files. Each sink stages under a unique name; the file is copied
+// to a unique ".part" file in OutDir which then replaces the target in one step. Failed
+// attempts are retried with growing delays (PublishRetries). Up to
+// PublishThreads files are published in parallel. A newer file for the same target
+// supersedes an older one still being published, so a stale export never wins.
+class Publisher : public QObject
+{
+	Q_OBJECT
+public:
+	static Publisher* instance();
+
+	// Returns the path a sink should write to and sets target to the final path in OutDir,
+	// or to an empty string if staging is off and the path already is the final one.
+	static QString stagedPath( const QString& fileName, QString& target );
+
+	void publish( const QString& staged, const QString& target );
+	int getPending() const;
+	void waitForDone(); // blocks until all queued files are published or given up
+signals:
+	void log( QString, int kind );
+private:
+	Publisher();
+	friend class PublishJob;
+	void done( const QString& msg, int kind );
+	enum Replace { Replaced, Failed, Superseded };
+	Replace replace( const QString& part, const QString& target, quint64 serial );
+	bool isSuperseded( const QString& target, quint64 serial ) const;
+	void finished( const QString& target, quint64 serial );
+	QThreadPool d_pool;
+	mutable QMutex d_lock;
+	int d_pending;
+	mutable QMutex d_targetsLock; // also serializes the replacement of the targets
+	QHash<QString,quint64> d_latest; // target -> serial of the newest publish
+	quint64 d_serial;
+};
+
+#endif // PUBLISHER_H
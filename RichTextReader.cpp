@@ -0,0 +1,473 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+#include "RichTextReader.h"
+#include "StreamAgent.h"
+#include <QTextCodec>
+
+static const int s_twipsPerPoint = 20;
+
+RichTextReader::RichTextReader():d_defFont(0),d_tableFont(-1),d_skipChars(0),d_star(false),d_codec(0),
+	d_picw(0),d_pich(0),d_goalw(0),d_goalh(0)
+{
+}
+
+bool RichTextReader::parse( const QString& rtf )
+{
+	d_pars.clear();
+	d_cur = Paragraph();
+	d_stack.clear();
+	d_state = State();
+	d_fontCharsets.clear();
+	d_defFont = 0;
+	d_tableFont = -1;
+	d_skipChars = 0;
+	d_star = false;
+	d_text.clear();
+	d_url.clear();
+	d_error.clear();
+	d_codec = QTextCodec::codecForName( "windows-1252" );
+	if( !rtf.startsWith( "{\\rtf" ) )
+	{
+		d_error = "not an RTF string";
+		return false;
+	}
+
+	const QChar* s = rtf.unicode();
+	const int len = rtf.size();
+	int i = 0;
+	while( i < len )
+	{
+		const ushort ch = s[i].unicode();
+		if( ch == '{' )
+		{
+			flush();
+			d_stack.append( d_state );
+			d_star = false;
+			i++;
+		}else if( ch == '}' )
+		{
+			flush();
+			i++;
+			if( d_stack.isEmpty() )
+				break; // end of document
+			if( d_state.d_dest == DestPict && d_stack.last().d_dest != DestPict )
+				endPicture();
+			d_state = d_stack.takeLast();
+		}else if( ch == '\\' )
+		{
+			i++;
+			if( i >= len )
+				break;
+			const QChar c = s[i];
+			if( ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) )
+			{
+				const int start = i;
+				while( i < len && ( ( s[i] >= 'a' && s[i] <= 'z' ) || ( s[i] >= 'A' && s[i] <= 'Z' ) ) )
+					i++;
+				const QByteArray word = rtf.mid( start, i - start ).toLatin1();
+				bool hasParam = false;
+				bool neg = false;
+				int param = 0;
+				if( i < len && s[i] == '-' )
+				{
+					neg = true;
+					i++;
+				}
+				while( i < len && s[i] >= '0' && s[i] <= '9' )
+				{
+					hasParam = true;
+					param = param * 10 + ( s[i].unicode() - '0' );
+					i++;
+				}
+				if( neg )
+					param = -param;
+				if( i < len && s[i] == ' ' )
+					i++; // delimiter belongs to the control word
+				flush();
+				if( word == "bin" && hasParam && param > 0 )
+					i += param; // binary picture data is not supported
+				else
+					controlWord( word, hasParam, param );
+			}else if( c == '\'' )
+			{
+				bool ok;
+				const int hex = rtf.mid( i + 1, 2 ).toInt( &ok, 16 );
+				i += 3;
+				if( ok )
+					addByte( char( hex ) );
+			}else
+			{
+				i++;
+				switch( c.unicode() )
+				{
+				case '*':
+					d_star = true;
+					break;
+				case '\\':
+				case '{':
+				case '}':
+					addChar( c );
+					break;
+				case '~':
+					addChar( QChar( 0xa0 ) );
+					break;
+				case '_':
+					addChar( QChar( '-' ) );
+					break;
+				case '\r':
+				case '\n':
+					flush();
+					controlWord( "par", false, 0 );
+					break;
+				default:
+					break; // \- and unknown control symbols
+				}
+			}
+		}else
+		{
+			if( ch != '\r' && ch != '\n' )
+				addChar( s[i] );
+			i++;
+		}
+	}
+	flush();
+	if( !d_cur.d_runs.isEmpty() )
+		d_pars.append( d_cur );
+	return true;
+}
+
+void RichTextReader::controlWord( const QByteArray& word, bool hasParam, int param )
+{
+	const bool star = d_star;
+	d_star = false;
+	switch( d_state.d_dest )
+	{
+	case DestSkip:
+	case DestFldInst:
+		return;
+	case DestFontTable:
+		if( word == "f" )
+			d_tableFont = param;
+		else if( word == "fcharset" )
+			d_fontCharsets[d_tableFont] = param;
+		return;
+	case DestPict:
+		// Nested groups like {\*\blipuid ..} or {\*\picprop ..} must not end up in the hex data
+		if( star || word == "blipuid" || word == "picprop" )
+			d_state.d_dest = DestSkip;
+		else if( word == "pngblip" || word == "jpegblip" || word == "wmetafile" || word == "emfblip" ||
+			word == "dibitmap" || word == "wbitmap" || word == "macpict" )
+			d_pictType = word;
+		else if( word == "picw" )
+			d_picw = param;
+		else if( word == "pich" )
+			d_pich = param;
+		else if( word == "picwgoal" )
+			d_goalw = param;
+		else if( word == "pichgoal" )
+			d_goalh = param;
+		return;
+	default:
+		break;
+	}
+
+	// Destinations
+	if( word == "fonttbl" )
+		d_state.d_dest = DestFontTable;
+	else if( word == "pict" )
+	{
+		d_state.d_dest = DestPict;
+		d_pict.clear();
+		d_pictType.clear();
+		d_picw = d_pich = d_goalw = d_goalh = 0;
+	}else if( word == "field" )
+		d_url.clear();
+	else if( word == "fldinst" )
+	{
+		d_state.d_dest = DestFldInst;
+		d_fldInst.clear();
+	}else if( word == "fldrslt" )
+	{
+		// Only HYPERLINK fields become url runs; the result of other fields is plain text
+		d_state.d_dest = DestFldRslt;
+		const int pos = d_fldInst.indexOf( "HYPERLINK" );
+		if( pos != -1 )
+		{
+			const int from = d_fldInst.indexOf( '"', pos );
+			const int to = ( from != -1 ) ? d_fldInst.indexOf( '"', from + 1 ) : -1;
+			if( to != -1 )
+				d_url = d_fldInst.mid( from + 1, to - from - 1 );
+			else
+				d_url = d_fldInst.mid( pos + 9 ).trimmed();
+		}
+		d_state.d_link = !d_url.isEmpty();
+	}else if( word == "pntext" || word == "listtext" || word == "pn" )
+	{
+		// Bullet resp. numbering of the paragraph; the marker text itself is not exported.
+		// DOORS does not report a meaningful bullet style, see DOORS-BUG in the DXL.
+		d_cur.d_bullet = true;
+		d_state.d_dest = DestSkip;
+	}else if( word == "shppict" || word == "result" )
+	{
+		// contains the picture resp. the presentation of an OLE object
+	}else if( star || word == "colortbl" || word == "stylesheet" || word == "info" || word == "nonshppict" ||
+		word == "header" || word == "footer" || word == "headerl" || word == "headerr" ||
+		word == "footerl" || word == "footerr" || word == "footnote" || word == "objdata" )
+		d_state.d_dest = DestSkip;
+
+	// Character formats
+	else if( word == "b" )
+		d_state.d_format.set( Bold, !hasParam || param != 0 );
+	else if( word == "i" )
+		d_state.d_format.set( Italic, !hasParam || param != 0 );
+	else if( word == "ulnone" )
+		d_state.d_format.reset( Underline );
+	else if( word == "ul" || word == "uld" || word == "uldb" || word == "ulw" || word == "ulth" ||
+		word == "uldash" || word == "ulwave" )
+		d_state.d_format.set( Underline, !hasParam || param != 0 );
+	else if( word == "strike" || word == "striked" )
+		d_state.d_format.set( Strikeout, !hasParam || param != 0 );
+	else if( word == "super" )
+	{
+		d_state.d_format.set( Super );
+		d_state.d_format.reset( Sub );
+	}else if( word == "sub" )
+	{
+		d_state.d_format.set( Sub );
+		d_state.d_format.reset( Super );
+	}else if( word == "nosupersub" )
+	{
+		d_state.d_format.reset( Sub );
+		d_state.d_format.reset( Super );
+	}else if( word == "plain" )
+	{
+		d_state.d_format.reset();
+		d_state.d_font = -1;
+	}else if( word == "f" )
+		d_state.d_font = param;
+	else if( word == "deff" )
+		d_defFont = param;
+	else if( word == "ansicpg" )
+	{
+		QTextCodec* c = QTextCodec::codecForName( "windows-" + QByteArray::number( param ) );
+		if( c == 0 )
+			c = QTextCodec::codecForName( "CP" + QByteArray::number( param ) );
+		if( c )
+			d_codec = c;
+	}else if( word == "uc" )
+		d_state.d_uc = param;
+	else if( word == "u" )
+	{
+		addChar( QChar( ushort( ( param < 0 ) ? param + 65536 : param ) ) );
+		d_skipChars = d_state.d_uc;
+	}
+
+	// Paragraphs
+	else if( word == "par" )
+		endParagraph();
+	else if( word == "pard" )
+	{
+		d_cur.d_indent = 0;
+		d_cur.d_bullet = false;
+		d_cur.d_bulletStyle = 0;
+	}else if( word == "li" )
+		d_cur.d_indent = param;
+	else if( word == "ls" )
+		d_cur.d_bullet = true;
+
+	// Special characters
+	else if( word == "tab" )
+		addChar( QChar( '\t' ) );
+	else if( word == "line" )
+		addChar( QChar( '\n' ) );
+	else if( word == "bullet" )
+		addChar( QChar( 0x2022 ) );
+	else if( word == "emdash" )
+		addChar( QChar( 0x2014 ) );
+	else if( word == "endash" )
+		addChar( QChar( 0x2013 ) );
+	else if( word == "lquote" )
+		addChar( QChar( 0x2018 ) );
+	else if( word == "rquote" )
+		addChar( QChar( 0x2019 ) );
+	else if( word == "ldblquote" )
+		addChar( QChar( 0x201c ) );
+	else if( word == "rdblquote" )
+		addChar( QChar( 0x201d ) );
+}
+
+void RichTextReader::addChar( QChar ch )
+{
+	switch( d_state.d_dest )
+	{
+	case DestText:
+	case DestFldRslt:
+		if( d_skipChars > 0 )
+			d_skipChars--;
+		else
+			d_text += ch;
+		break;
+	case DestFldInst:
+		d_fldInst += ch;
+		break;
+	case DestPict:
+		if( ( ch >= '0' && ch <= '9' ) || ( ch >= 'a' && ch <= 'f' ) || ( ch >= 'A' && ch <= 'F' ) )
+			d_pict += ch.toLatin1();
+		break;
+	default:
+		break;
+	}
+}
+
+void RichTextReader::addByte( char b )
+{
+	if( d_state.d_dest != DestText && d_state.d_dest != DestFldRslt )
+		return;
+	if( d_skipChars > 0 )
+	{
+		d_skipChars--;
+		return;
+	}
+	// Symbol, Greek etc. are passed as is and flagged by the charset of the run, like DOORS does
+	if( charsetOf( d_state.d_font ) == 0 && d_codec )
+		d_text += d_codec->toUnicode( &b, 1 );
+	else
+		d_text += QChar( (uchar)b );
+}
+
+void RichTextReader::flush()
+{
+	if( d_text.isEmpty() )
+		return;
+	Run r;
+	r.d_format = d_state.d_format;
+	r.d_charset = charsetOf( d_state.d_font );
+	if( d_state.d_link )
+		r.d_url = d_url;
+	if( !d_cur.d_runs.isEmpty() )
+	{
+		Run& last = d_cur.d_runs.last();
+		if( !last.isPicture() && last.d_format == r.d_format && last.d_charset == r.d_charset &&
+			last.d_url == r.d_url )
+		{
+			last.d_text += d_text;
+			d_text.clear();
+			return;
+		}
+	}
+	r.d_text = d_text;
+	d_text.clear();
+	d_cur.d_runs.append( r );
+}
+
+void RichTextReader::endParagraph()
+{
+	flush();
+	d_pars.append( d_cur );
+	// Paragraph properties stay in effect until \pard
+	Paragraph next;
+	next.d_indent = d_cur.d_indent;
+	next.d_bullet = d_cur.d_bullet;
+	next.d_bulletStyle = d_cur.d_bulletStyle;
+	d_cur = next;
+}
+
+void RichTextReader::endPicture()
+{
+	Run r;
+	bool ok = false;
+	int w = 0, h = 0;
+	if( d_pictType == "pngblip" || d_pictType == "jpegblip" )
+	{
+		const QByteArray data = QByteArray::fromHex( d_pict );
+		if( d_pictType == "pngblip" && StreamAgent::pngSize( data, w, h ) )
+		{
+			r.d_png = data; // the stream takes the PNG as it is
+			ok = true;
+		}else
+			ok = r.d_img.loadFromData( data );
+	}
+	if( !ok )
+	{
+		r.d_img.load( ":/DoorScopeEtl/img_placeholder.png" );
+		d_error = "cannot decode embedded picture of type " + d_pictType;
+	}
+	if( !r.d_img.isNull() )
+	{
+		w = r.d_img.width();
+		h = r.d_img.height();
+	}
+	if( d_goalw > 0 && d_goalh > 0 )
+	{
+		r.d_width = double( d_goalw ) / s_twipsPerPoint;
+		r.d_height = double( d_goalh ) / s_twipsPerPoint;
+	}else
+	{
+		r.d_width = w * 0.75; // 96 dpi
+		r.d_height = h * 0.75;
+	}
+	d_cur.d_runs.append( r );
+	d_pict.clear();
+}
+
+char RichTextReader::charsetOf( int font ) const
+{
+	switch( d_fontCharsets.value( ( font < 0 ) ? d_defFont : font, 0 ) )
+	{
+	case 0: // ANSI
+	case 1: // Default
+		return 0;
+	case 2:
+		return 'y';
+	case 161:
+		return 'g';
+	default:
+		return '?';
+	}
+}
+
+bool RichTextReader::isFormatted() const
+{
+	for( int i = 0; i < d_pars.size(); i++ )
+	{
+		const Paragraph& p = d_pars[i];
+		if( p.d_bullet || p.d_indent > 0 )
+			return true;
+		for( int j = 0; j < p.d_runs.size(); j++ )
+		{
+			const Run& r = p.d_runs[j];
+			if( r.d_format.any() || r.d_charset != 0 || !r.d_url.isEmpty() || r.isPicture() )
+				return true;
+		}
+	}
+	return false;
+}
+
+QString RichTextReader::getPlainText() const
+{
+	QString res;
+	for( int i = 0; i < d_pars.size(); i++ )
+	{
+		if( i > 0 )
+			res += QChar( '\n' );
+		const Paragraph& p = d_pars[i];
+		for( int j = 0; j < p.d_runs.size(); j++ )
+			res += p.d_runs[j].d_text;
+	}
+	return res;
+}
@@ -0,0 +1,104 @@
+#ifndef RICHTEXTREADER_H
+#define RICHTEXTREADER_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QString>
+#include <QList>
+#include <QMap>
+#include <QImage>
+#include <QByteArray>
+#include <bitset>
+
+class QTextCodec;
+
+// Converts the rich text of a DOORS attribute (RTF as returned by richText() resp.
+// richTextWithOle()) into paragraphs and formatted runs, the same structure the DXL
+// used to walk with RichTextParagraph and RichText. Unknown destinations are skipped.
+class RichTextReader
+{
+public:
+	enum CharFormat { Italic, Bold, Underline, Strikeout, Super, Sub }; // Index in bitset
+
+	struct Run
+	{
+		std::bitset<8> d_format;
+		char d_charset; // 0: ANSI, 'y': Symbol, 'g': Greek, '?': other
+		QString d_text;
+		QString d_url; // not empty if the run is a hyperlink
+		QImage d_img; // not null if the run is an embedded picture resp. OLE object
+		QByteArray d_png; // instead of d_img if the picture is a PNG; not decoded
+		double d_width, d_height; // of the picture in points
+		Run():d_charset(0),d_width(0.0),d_height(0.0){}
+		bool isPicture() const { return !d_img.isNull() || !d_png.isEmpty(); }
+	};
+	struct Paragraph
+	{
+		int d_indent; // twips
+		bool d_bullet;
+		int d_bulletStyle;
+		QList<Run> d_runs;
+		Paragraph():d_indent(0),d_bullet(false),d_bulletStyle(0){}
+	};
+
+	RichTextReader();
+
+	bool parse( const QString& rtf ); // return: false if rtf is not RTF
+	const QList<Paragraph>& getParagraphs() const { return d_pars; }
+	// True if there is more than plain text; same criteria as probeRichText in the DXL
+	bool isFormatted() const;
+	QString getPlainText() const;
+	const QString& getError() const { return d_error; } // also set for pictures which could not be decoded
+private:
+	enum Dest { DestText, DestSkip, DestFontTable, DestPict, DestFldInst, DestFldRslt };
+	struct State
+	{
+		std::bitset<8> d_format;
+		int d_font;
+		int d_uc;
+		Dest d_dest;
+		bool d_link;
+		State():d_font(-1),d_uc(1),d_dest(DestText),d_link(false){}
+	};
+	void controlWord( const QByteArray& word, bool hasParam, int param );
+	void addChar( QChar );
+	void addByte( char );
+	void flush();
+	void endParagraph();
+	void endPicture();
+	char charsetOf( int font ) const;
+
+	QList<Paragraph> d_pars;
+	Paragraph d_cur;
+	QList<State> d_stack;
+	State d_state;
+	QMap<int,int> d_fontCharsets; // font number -> \fcharset
+	int d_defFont;
+	int d_tableFont; // font being defined in the font table
+	int d_skipChars; // ANSI replacement characters still to skip after \u
+	bool d_star; // \* seen, i.e. the following destination may be ignored
+	QString d_text; // pending text of the current run
+	QTextCodec* d_codec; // for \'hh in ANSI fonts; see \ansicpg
+	QString d_fldInst;
+	QString d_url;
+	QByteArray d_pict; // hex digits of the current \pict
+	QByteArray d_pictType;
+	int d_picw, d_pich, d_goalw, d_goalh;
+	QString d_error;
+};
+
+#endif // RICHTEXTREADER_H
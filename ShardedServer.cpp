@@ -0,0 +1,302 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "ShardedServer.h"
+#include "IpcProtocol.h"
+#include "Publisher.h"
+#include <QTcpServer>
+#include <QTimer>
+#include <QSettings>
+#include <QCoreApplication>
+#include <stdio.h>
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+static const int s_statusInterval = 2000; // ms
+
+#ifdef Q_OS_UNIX
+// QTcpServer cannot set socket options before bind; so the socket is created here
+// and handed over with setSocketDescriptor.
+static int createSharedSocket( quint16 port, bool localhostOnly )
+{
+	const int fd = ::socket( AF_INET, SOCK_STREAM, 0 );
+	if( fd < 0 )
+		return -1;
+	int on = 1;
+	::setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+#ifdef SO_REUSEPORT
+	if( ::setsockopt( fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on) ) != 0 )
+	{
+		::close( fd );
+		return -1;
+	}
+#endif
+	sockaddr_in addr;
+	::memset( &addr, 0, sizeof(addr) );
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons( port );
+	addr.sin_addr.s_addr = htonl( ( localhostOnly ) ? INADDR_LOOPBACK : INADDR_ANY );
+	if( ::bind( fd, (sockaddr*)&addr, sizeof(addr) ) != 0 || ::listen( fd, 128 ) != 0 )
+	{
+		::close( fd );
+		return -1;
+	}
+	return fd;
+}
+#endif
+
+Worker::Worker( int index, QObject* parent )
+	: QObject( parent ), d_closedBytes( 0 ), d_index( index )
+{
+	QSettings set;
+	d_logTrace = set.value( "LogTrace", false ).toBool();
+	StreamAgent::setTrace( d_logTrace );
+	connect( Publisher::instance(), SIGNAL( log( QString, int ) ), this, SLOT( onLog( QString, int ) ) );
+	d_server = new QTcpServer( this );
+	connect( d_server, SIGNAL( newConnection ()), this, SLOT( onNewConnection() ) );
+	QTimer* t = new QTimer( this );
+	connect( t, SIGNAL( timeout() ), this, SLOT( onStatus() ) );
+	t->start( s_statusInterval );
+}
+
+bool Worker::listen( quint16 port, bool localhostOnly )
+{
+#ifdef Q_OS_UNIX
+	const int fd = createSharedSocket( port, localhostOnly );
+	if( fd < 0 || !d_server->setSocketDescriptor( fd ) )
+	{
+		onLog( QString( "Worker %1 cannot listen on port %2" ).arg( d_index ).arg( port ), 2 );
+		return false;
+	}
+	onLog( QString( "Worker %1 listening on port %2" ).arg( d_index ).arg( port ), 1 );
+	return true;
+#else
+	onLog( "Worker processes are not supported on this platform", 2 );
+	return false;
+#endif
+}
+
+void Worker::onNewConnection()
+{
+	QTcpSocket* sock = d_server->nextPendingConnection(); 
+	if( sock == 0 )
+		return;
+	IpcProtocol* p = new IpcProtocol( sock );
+	connect( sock, SIGNAL( disconnected() ), sock, SLOT( deleteLater() ) );
+	connect( sock, SIGNAL(readyRead()), p, SLOT(onData()) ); 
+	connect( sock, SIGNAL( disconnected() ), p, SLOT( onDisconnected() ) ); // before our onDisconnected
+	connect( sock, SIGNAL(error(QAbstractSocket::SocketError)), p, SLOT(onError(QAbstractSocket::SocketError)));
+	connect( &p->d_agent, SIGNAL( log( QString, int ) ), this, SLOT( onLog( QString, int ) ) );
+	connect( sock, SIGNAL( disconnected() ), this, SLOT( onDisconnected() ) );
+	connect( sock, SIGNAL( destroyed( QObject* ) ), this, SLOT( onClosed( QObject* ) ) );
+	d_active[sock] = p;
+}
+
+void Worker::onDisconnected()
+{
+	IpcProtocol* p = d_active.value( sender() );
+	if( p )
+	{
+		d_closedBytes += p->d_agent.d_metrics.d_bytesReceived;
+		d_active.remove( sender() );
+	}
+}
+
+void Worker::onClosed( QObject* sock )
+{
+	// Only the address is used as a key; the socket is already half destroyed
+	d_active.remove( sock );
+}
+
+void Worker::onLog( QString msg, int kind )
+{
+	if( kind == 0 && !d_logTrace )
+		return;
+	// One line per message: "<kind> <text>"
+	msg.replace( QChar('\n'), QChar(' ') );
+	const QByteArray line = QByteArray::number( kind ) + " " + msg.toUtf8() + "\n";
+	fwrite( line.constData(), 1, line.size(), stdout );
+	fflush( stdout );
+}
+
+void Worker::onStatus()
+{
+	quint64 bytes = d_closedBytes;
+	QMap<QObject*,IpcProtocol*>::const_iterator i;
+	for( i = d_active.begin(); i != d_active.end(); ++i )
+		bytes += i.value()->d_agent.d_metrics.d_bytesReceived;
+	// Status line: "S <connections> <bytes received>"
+	const QByteArray line = "S " + QByteArray::number( d_active.size() ) + " " + QByteArray::number( bytes ) + "\n";
+	fwrite( line.constData(), 1, line.size(), stdout );
+	fflush( stdout );
+}
+
+Supervisor::Supervisor( QObject* parent )
+	: QObject( parent ), d_port( 0 ), d_localhostOnly( false ), d_maxFailures( 10 ), d_stopping( false )
+{
+}
+
+Supervisor::~Supervisor()
+{
+	stop();
+}
+
+bool Supervisor::isSupported()
+{
+#if defined( Q_OS_UNIX ) && defined( SO_REUSEPORT )
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Supervisor::start( int workers, quint16 port, bool localhostOnly )
+{
+	stop();
+	d_stopping = false;
+	d_port = port;
+	d_localhostOnly = localhostOnly;
+	QSettings set;
+	d_maxFailures = set.value( "WorkerMaxRestarts", 10 ).toInt();
+	d_workers.resize( workers );
+	for( int i = 0; i < workers; i++ )
+		spawn( i );
+	emit log( QString( "Started %1 worker processes on port %2" ).arg( workers ).arg( port ), 1 );
+}
+
+void Supervisor::stop()
+{
+	d_stopping = true;
+	for( int i = 0; i < d_workers.size(); i++ )
+	{
+		delete d_workers[i].d_retry;
+		QProcess* p = d_workers[i].d_proc;
+		if( p == 0 )
+			continue;
+		p->terminate();
+		if( !p->waitForFinished( 3000 ) )
+			p->kill();
+		delete p;
+	}
+	d_workers.clear();
+}
+
+void Supervisor::spawn( int index )
+{
+	Info& info = d_workers[index];
+	info.d_connections = 0;
+	info.d_started.start();
+	info.d_proc = new QProcess( this );
+	info.d_proc->setProperty( "index", index );
+	info.d_proc->setProcessChannelMode( QProcess::MergedChannels );
+	connect( info.d_proc, SIGNAL( readyReadStandardOutput() ), this, SLOT( onOutput() ) );
+	connect( info.d_proc, SIGNAL( finished( int, QProcess::ExitStatus ) ), 
+		this, SLOT( onFinished( int, QProcess::ExitStatus ) ) );
+	info.d_proc->start( QCoreApplication::applicationFilePath(), QStringList() << "-worker" << 
+		QString::number( index ) << QString::number( d_port ) << ( d_localhostOnly ? "1" : "0" ) );
+}
+
+void Supervisor::onOutput()
+{
+	QProcess* p = static_cast<QProcess*>( sender() );
+	const int index = p->property( "index" ).toInt();
+	while( p->canReadLine() )
+	{
+		const QByteArray line = p->readLine().trimmed();
+		if( line.startsWith( "S " ) )
+		{
+			const QList<QByteArray> parts = line.split( ' ' );
+			if( parts.size() == 3 )
+			{
+				d_workers[index].d_connections = parts[1].toInt();
+				d_workers[index].d_bytes = parts[2].toULongLong();
+				updateStatus();
+			}
+		}else if( line.size() > 2 && line[1] == ' ' && line[0] >= '0' && line[0] <= '2' )
+			emit log( QString( "[%1] " ).arg( index ) + QString::fromUtf8( line.mid( 2 ) ), line[0] - '0' );
+		else if( !line.isEmpty() )
+			emit log( QString( "[%1] " ).arg( index ) + QString::fromUtf8( line ), 1 );
+	}
+}
+
+void Supervisor::onFinished( int code, QProcess::ExitStatus st )
+{
+	QProcess* p = static_cast<QProcess*>( sender() );
+	if( d_stopping )
+		return;
+	const int index = p->property( "index" ).toInt();
+	p->deleteLater();
+	Info& info = d_workers[index];
+	info.d_proc = 0;
+	// A worker which ran for a while failed on its own; one which exits at once (e.g. because it
+	// cannot bind the port) would only fail again, so it is restarted with growing delays
+	if( info.d_started.elapsed() >= 60000 )
+		info.d_failures = 0;
+	info.d_failures++;
+	const QString what = QString( "Worker %1 %2 (code %3)" ).arg( index ).
+		arg( ( st == QProcess::CrashExit ) ? "crashed" : "exited" ).arg( code );
+	if( d_maxFailures >= 0 && info.d_failures > d_maxFailures )
+	{
+		emit log( what + QString( "; gave up after %1 restarts in a row" ).arg( d_maxFailures ), 2 );
+		updateStatus();
+		return;
+	}
+	const int delay = qMin( 1000 << qMin( info.d_failures - 1, 6 ), 60000 ); // ms
+	emit log( what + QString( "; restarting in %1 s" ).arg( delay / 1000 ), 2 );
+	if( info.d_retry == 0 )
+	{
+		info.d_retry = new QTimer( this );
+		info.d_retry->setSingleShot( true );
+		info.d_retry->setProperty( "index", index );
+		connect( info.d_retry, SIGNAL( timeout() ), this, SLOT( onRespawn() ) );
+	}
+	info.d_retry->start( delay );
+	updateStatus();
+}
+
+void Supervisor::onRespawn()
+{
+	if( d_stopping )
+		return;
+	const int index = sender()->property( "index" ).toInt();
+	if( index < 0 || index >= d_workers.size() || d_workers[index].d_proc != 0 )
+		return;
+	d_workers[index].d_restarts++;
+	spawn( index );
+	updateStatus();
+}
+
+void Supervisor::updateStatus()
+{
+	int conns = 0;
+	quint64 bytes = 0;
+	int restarts = 0;
+	for( int i = 0; i < d_workers.size(); i++ )
+	{
+		conns += d_workers[i].d_connections;
+		bytes += d_workers[i].d_bytes;
+		restarts += d_workers[i].d_restarts;
+	}
+	emit status( tr( "%1 workers, %2 connections, %3 MB received, %4 restarts" ).
+		arg( d_workers.size() ).arg( conns ).arg( double( bytes ) / ( 1024.0 * 1024.0 ), 0, 'f', 1 ).
+		arg( restarts ) );
+}
@@ -0,0 +1,94 @@
+#ifndef SHARDEDSERVER_H
+#define SHARDEDSERVER_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QObject>
+#include <QMap>
+#include <QVector>
+#include <QProcess>
+#include <QTime>
+
+class QTcpServer;
+class QTimer;
+class IpcProtocol;
+
+// Multi-process mode: the Supervisor runs in the GUI process and starts n Worker processes
+// (DoorScopeEtl -worker i). Each worker binds its own listening socket to the same port
+// using SO_REUSEPORT, so the kernel spreads incoming connections over the workers, and each
+// worker runs independent IpcProtocol instances. A crashing export only takes down its worker,
+// which is restarted by the supervisor. Workers report log lines and status on stdout.
+// Only available on Unix; SO_REUSEPORT has no equivalent on Windows.
+
+class Worker : public QObject
+{
+	Q_OBJECT
+public:
+	Worker( int index, QObject* parent = 0 );
+	bool listen( quint16 port, bool localhostOnly );
+protected slots:
+	void onNewConnection();
+	void onLog( QString, int kind );
+	void onDisconnected();
+	void onClosed( QObject* );
+	void onStatus();
+private:
+	QTcpServer* d_server;
+	QMap<QObject*,IpcProtocol*> d_active; // socket -> protocol
+	quint64 d_closedBytes;
+	int d_index;
+	bool d_logTrace;
+};
+
+class Supervisor : public QObject
+{
+	Q_OBJECT
+public:
+	Supervisor( QObject* parent = 0 );
+	~Supervisor();
+	static bool isSupported();
+	void start( int workers, quint16 port, bool localhostOnly );
+	void stop();
+signals:
+	void log( QString, int kind );
+	void status( QString );
+protected slots:
+	void onOutput();
+	void onFinished( int, QProcess::ExitStatus );
+	void onRespawn();
+private:
+	void spawn( int index );
+	void updateStatus();
+	struct Info
+	{
+		QProcess* d_proc;
+		int d_connections;
+		quint64 d_bytes;
+		int d_restarts;
+		int d_failures; // restarts in a row without a worker running long enough
+		QTime d_started;
+		QTimer* d_retry; // delays the restart, see onFinished
+		Info():d_proc(0),d_connections(0),d_bytes(0),d_restarts(0),d_failures(0),d_retry(0){}
+	};
+	QVector<Info> d_workers;
+	quint16 d_port;
+	bool d_localhostOnly;
+	int d_maxFailures;
+	bool d_stopping;
+};
+
+#endif // SHARDEDSERVER_H
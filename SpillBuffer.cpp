@@ -0,0 +1,101 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "SpillBuffer.h"
+#include <QTemporaryFile>
+#include <QDir>
+
+SpillBuffer::SpillBuffer( qint64 threshold, QObject* parent )
+	: QIODevice( parent ), d_file( 0 ), d_map( 0 ), d_threshold( threshold ),
+	d_spillFailed( false )
+{
+	open( QIODevice::WriteOnly | QIODevice::Unbuffered );
+}
+
+SpillBuffer::~SpillBuffer()
+{
+	if( d_file )
+	{
+		if( d_map )
+			d_file->unmap( d_map );
+		delete d_file; // removes the temp file
+	}
+}
+
+qint64 SpillBuffer::size() const
+{
+	if( d_file )
+		return d_file->size();
+	else
+		return d_buf.size();
+}
+
+bool SpillBuffer::spill()
+{
+	d_file = new QTemporaryFile( QDir::temp().absoluteFilePath( "DoorScopeEtl_embed.XXXXXX" ) );
+	if( !d_file->open() )
+	{
+		setErrorString( d_file->errorString() );
+		delete d_file;
+		d_file = 0;
+		return false;
+	}
+	if( d_file->write( d_buf ) != d_buf.size() )
+	{
+		setErrorString( d_file->errorString() );
+		delete d_file;
+		d_file = 0;
+		return false;
+	}
+	d_buf = QByteArray(); // release the memory, not only clear
+	return true;
+}
+
+qint64 SpillBuffer::writeData( const char* data, qint64 len )
+{
+	if( d_map )
+		return -1; // data() was already called
+	if( d_file == 0 && !d_spillFailed && d_threshold > 0 && d_buf.size() + len > d_threshold )
+	{
+		// If the temp file cannot be created we just go on in memory
+		d_spillFailed = !spill();
+	}
+	if( d_file )
+		return d_file->write( data, len );
+	d_buf.append( data, len );
+	return len;
+}
+
+QByteArray SpillBuffer::data()
+{
+	if( d_file == 0 )
+		return d_buf;
+	if( d_map == 0 )
+	{
+		d_file->flush();
+		const qint64 len = d_file->size();
+		if( len == 0 )
+			return QByteArray();
+		d_map = d_file->map( 0, len );
+		if( d_map == 0 )
+		{
+			// Mapping not supported; fall back to reading the file
+			d_file->seek( 0 );
+			return d_file->readAll();
+		}
+	}
+	return QByteArray::fromRawData( (const char*)d_map, d_file->size() );
+}
@@ -0,0 +1,54 @@
+#ifndef SPILLBUFFER_H
+#define SPILLBUFFER_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QIODevice>
+#include <QByteArray>
+
+class QTemporaryFile;
+
+// Write-only device which keeps its contents in memory until the threshold is passed
+// and then moves everything to a temporary file. Used for embedded BML streams which
+// can get huge when a rich text attribute contains many large OLE pictures.
+class SpillBuffer : public QIODevice
+{
+public:
+	SpillBuffer( qint64 threshold, QObject* parent = 0 );
+	~SpillBuffer();
+
+	bool isSpilled() const { return d_file != 0; }
+	// True if the temp file could not be created resp. written; see errorString()
+	bool spillFailed() const { return d_spillFailed; }
+	qint64 size() const;
+	// Returns the written data; if spilled the array refers to a memory mapping of the
+	// temp file, which is only valid as long as this object lives.
+	QByteArray data();
+	bool isSequential() const { return true; }
+protected:
+	qint64 readData( char*, qint64 ) { return -1; }
+	qint64 writeData( const char* data, qint64 len );
+private:
+	bool spill();
+	QByteArray d_buf;
+	QTemporaryFile* d_file;
+	uchar* d_map;
+	qint64 d_threshold;
+	bool d_spillFailed; // stays in memory, don't try again with every write
+};
+
+#endif // SPILLBUFFER_H
@@ -15,6 +15,10 @@
 */
 
 #include "StreamAgent.h"
+#include "SpillBuffer.h"
+#include "OutputSink.h"
+#include "Tracer.h"
+#include "RichTextReader.h"
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
@@ -23,62 +27,278 @@
 #include <QApplication>
 #include <QMimeData>
 #include <QSettings>
+#include <QStringList>
 #include <Stream/Exceptions.h>
+#include <string.h>
 #include <QDir>
  
+static const qint64 s_defaultSpillThreshold = 16 * 1024 * 1024;
+bool StreamAgent::s_trace = false;
+
 StreamAgent::StreamAgent(QObject *parent)
-    : QObject(parent)
+    : QObject(parent), d_spillThreshold( s_defaultSpillThreshold ), d_track( 0 ), d_asyncSinks( false ),
+	d_passthrough( true )
 {
 	d_outs.append( Slot() );
 }
 
 StreamAgent::~StreamAgent()
 {
+	clearOuts();
+	clearSinks();
 }
 
-void StreamAgent::open( QString name )
+void StreamAgent::clearOuts()
 {
-	// close();
+	QLinkedList<Slot>::iterator i;
+	for( i = d_outs.begin(); i != d_outs.end(); ++i )
+	{
+		if( (*i).d_spill )
+		{
+			(*i).d_out.setDevice( 0 );
+			delete (*i).d_spill;
+		}
+	}
 	d_outs.clear();
+}
+
+void StreamAgent::clearSinks()
+{
+	for( int i = 0; i < d_sinks.size(); i++ )
+	{
+		OutputSink* sink = d_sinks[i];
+		try
+		{
+			sink->close();
+		}catch( Stream::StreamException& e )
+		{
+			onError( QString( "StreamAgent::close %1 %2" ).arg( e.getCode() ).arg( QString( e.getMsg() ) ) );
+		}catch( std::exception& e )
+		{
+			onError( "StreamAgent::close " + QString( e.what() ) );
+		}catch( ... )
+		{
+			onError( "StreamAgent::close: unknown exception" );
+		}
+		const QString err = sink->getError();
+		if( !err.isEmpty() )
+			onError( "StreamAgent::close: sink failed: " + err );
+		else
+			onStatus( "Closed " + sink->getSummary() );
+		QMutexLocker lock( &d_sinksLock );
+		d_sinks[i] = 0;
+		delete sink;
+	}
+	QMutexLocker lock( &d_sinksLock );
+	d_sinks.clear();
+	d_asyncSinks = false;
+}
+
+void StreamAgent::callSinks( SinkCall call, const QByteArray& name, const Stream::DataCell& value )
+{
+	// Each sink on its own, so that a failing sink doesn't cut the stream to the others
+	static const char* s_where[] = { "writeCell", "startFrame", "endFrame" };
+	int i = 0;
+	while( i < d_sinks.size() )
+	{
+		QString err;
+		try
+		{
+			switch( call )
+			{
+			case SinkSlot:
+				d_sinks[i]->writeSlot( name, value );
+				break;
+			case SinkStartFrame:
+				d_sinks[i]->startFrame( name );
+				break;
+			case SinkEndFrame:
+				d_sinks[i]->endFrame();
+				break;
+			}
+		}catch( Stream::StreamException& e )
+		{
+			err = QString( "%1 %2" ).arg( e.getCode() ).arg( QString( e.getMsg() ) );
+		}catch( std::exception& e )
+		{
+			err = e.what();
+		}catch( ... )
+		{
+			err = "unknown exception";
+		}
+		if( err.isEmpty() )
+			i++;
+		else
+			dropSink( i, s_where[call], err );
+	}
+}
+
+void StreamAgent::dropSink( int i, const char* where, const QString& error )
+{
+	OutputSink* sink = d_sinks[i];
+	const QString summary = sink->getSummary();
+	onError( QString( "StreamAgent::%1: sink %2 %3 failed and is dropped: %4" ).arg( where ).
+		arg( i ).arg( summary ).arg( error ) );
+	try
+	{
+		sink->close(); // the sink is broken anyway, just release what it holds
+	}catch( ... )
+	{
+	}
+	QMutexLocker lock( &d_sinksLock );
+	d_sinks.removeAt( i );
+	delete sink;
+}
+
+void StreamAgent::open( const QString& name )
+{
+	// close();
+	clearOuts();
+	clearSinks();
 	d_outs.append( Slot() );
+	d_descriptors.clear();
 
 	QSettings set;
-	QDir dir( set.value( "OutDir", QDir::currentPath() ).toString() );
-	QFile* f = new QFile( dir.absoluteFilePath( name + ".dsdx" ) );
-	if( !f->open( QIODevice::WriteOnly | QIODevice::Unbuffered ) )
+	d_spillThreshold = set.value( "EmbedSpillThreshold", s_defaultSpillThreshold ).toLongLong();
+	d_passthrough = set.value( "ImagePassthrough", true ).toBool();
+	d_name = name;
+	d_metrics.d_opened = Metrics::now();
+	// Sinks: comma separated list of dsdx, jsonl, csv and null; all of them get the same stream
+	const QStringList kinds = set.value( "Sinks", "dsdx" ).toString().split( QChar(','), QString::SkipEmptyParts );
+	const bool async = set.value( "AsyncSinks", false ).toBool();
+	for( int i = 0; i < kinds.size(); i++ )
 	{
-		delete f;
-		onError( "StreamAgent::open: Cannot open file for writing" );
-		return;
+		OutputSink* sink = OutputSink::create( kinds[i] );
+		if( sink == 0 )
+		{
+			onError( "StreamAgent::open: unknown sink " + kinds[i] );
+			continue;
+		}
+		if( async )
+			sink = new AsyncSink( sink );
+		QString err;
+		if( !sink->open( name, err ) )
+		{
+			delete sink;
+			onError( "StreamAgent::open: " + err );
+			continue;
+		}
+		onStatus( QString( "Created %1 stream %2" ).arg( kinds[i].trimmed() ).arg( sink->getSummary() ) );
+		QMutexLocker lock( &d_sinksLock );
+		d_sinks.append( sink );
+		d_asyncSinks |= sink->isAsync();
 	}
-	onStatus( QString( "Created stream %1" ).arg( f->fileName() ) );
-	d_outs.back().d_out.setDevice( f, true );
 }
 
 void StreamAgent::close()
 {
 	if( d_outs.size() > 1 )
 		onError( "StreamAgent::close: endEmbed missing from level " + QString::number( d_outs.size() ) );
-	d_outs.clear();
+	const quint64 start = Metrics::now();
+	clearOuts();
+	clearSinks();
+	if( Tracer::isOn() )
+		Tracer::complete( "flush", "file", d_track, start, Metrics::now() );
 	d_outs.append( Slot() );
 	onStatus( "Closing stream" );
 }
 
+void StreamAgent::record( const QString& name )
+{
+	clearOuts();
+	clearSinks();
+	d_outs.append( Slot() );
+	d_descriptors.clear();
+
+	QSettings set;
+	d_spillThreshold = set.value( "EmbedSpillThreshold", s_defaultSpillThreshold ).toLongLong();
+	d_passthrough = set.value( "ImagePassthrough", true ).toBool();
+	d_name = name;
+	d_metrics.d_opened = Metrics::now();
+	OutputSink* sink = new RecordingSink();
+	QString err;
+	sink->open( name, err );
+	QMutexLocker lock( &d_sinksLock );
+	d_sinks.append( sink );
+	d_asyncSinks = true;
+}
+
+void StreamAgent::replay( StreamAgent& recorder )
+{
+	RecordingSink* rec = 0;
+	if( recorder.d_sinks.size() == 1 )
+		rec = dynamic_cast<RecordingSink*>( recorder.d_sinks.first() );
+	if( rec == 0 )
+	{
+		onError( "StreamAgent::replay: agent is not recording" );
+		return;
+	}
+	if( recorder.d_outs.size() > 1 )
+		onError( "StreamAgent::replay: endEmbed missing from level " + QString::number( recorder.d_outs.size() ) );
+	if( d_outs.size() > 1 )
+	{
+		onError( "StreamAgent::replay: cannot replay into an embed" );
+		return;
+	}
+	try
+	{
+		if( s_trace )
+			onTrace( QString( "Replay %1 bytes" ).arg( rec->getSize() ) );
+		const quint64 start = Metrics::now();
+		for( int i = 0; i < d_sinks.size(); i++ )
+			rec->replay( d_sinks[i] );
+		d_metrics.add( recorder.d_metrics );
+		d_metrics.addTime( Metrics::Write, start );
+	}catch( Stream::StreamException& e )
+	{
+		onError( QString( "StreamAgent::replay %1 %2" ).arg( e.getCode() ).arg( QString( e.getMsg() ) ) );
+	}catch( std::exception& e )
+	{
+		onError( "StreamAgent::replay " + QString( e.what() ) );
+	}catch( ... )
+	{
+		onError( "StreamAgent::replay: unknown exception" );
+	}
+}
+
+qint64 StreamAgent::getOutputSize() const
+{
+	QMutexLocker lock( &d_sinksLock );
+	qint64 res = -1;
+	for( int i = 0; i < d_sinks.size(); i++ )
+	{
+		if( d_sinks[i] == 0 )
+			continue; // being closed
+		const qint64 size = d_sinks[i]->getSize();
+		if( size >= 0 )
+			res = qMax( res, qint64(0) ) + size;
+	}
+	return res;
+}
+
 void StreamAgent::writeCell( const QByteArray& name, const Stream::DataCell& value )
 {
 	try
 	{
-		onTrace( QString( "WriteCell '%1' (%2) = %3" ).
-			arg( QString::fromLatin1( name ) ).
-			arg( QString::fromLatin1(Stream::DataCell::typePrettyName[value.getType()]) ).
-			arg( value.toPrettyString() ) );
-		if( name.isEmpty() )
+		if( s_trace ) // toPrettyString is expensive
+			onTrace( QString( "WriteCell '%1' (%2) = %3" ).
+				arg( QString::fromLatin1( name ) ).
+				arg( QString::fromLatin1(Stream::DataCell::typePrettyName[value.getType()]) ).
+				arg( value.toPrettyString() ) );
+		const quint64 start = Metrics::now();
+		if( d_outs.size() == 1 )
+		{
+			callSinks( SinkSlot, name, value );
+		}else if( name.isEmpty() )
 		{
 			d_outs.back().d_out.writeSlot( value );
 		}else
 		{
 			d_outs.back().d_out.writeSlot( value, name.data(), true );
 		}
+		d_metrics.addTime( Metrics::Write, start );
+		if( value.getType() < Metrics::MaxCellType )
+			d_metrics.d_cells[value.getType()]++;
 	}catch( Stream::StreamException& e )
 	{
 		onError( QString( "StreamAgent::writeCell %1 %2" ).arg( e.getCode() ).arg( QString( e.getMsg() ) ) );
@@ -91,92 +311,333 @@ void StreamAgent::writeCell( const QByteArray& name, const Stream::DataCell& val
 	}
 }
 
-void StreamAgent::loadImg( QString filePath, bool deleteAfterwards, QByteArray name )
+bool StreamAgent::removeTemp( const QString& filePath )
+{
+	// Any client may connect, so a client must not be able to delete arbitrary files
+	const QString temp = QDir( QDir::tempPath() ).canonicalPath();
+	const QString dir = QFileInfo( filePath ).canonicalPath();
+	if( temp.isEmpty() || dir.isEmpty() )
+		return false;
+#ifdef Q_OS_WIN
+	const Qt::CaseSensitivity cs = Qt::CaseInsensitive;
+#else
+	const Qt::CaseSensitivity cs = Qt::CaseSensitive;
+#endif
+	if( dir.compare( temp, cs ) != 0 && !dir.startsWith( temp + "/", cs ) )
+		return false;
+	return QFile::remove( filePath );
+}
+
+static bool readPng( const QString& filePath, QByteArray& png, int& w, int& h )
+{
+	QFile f( filePath );
+	if( !f.open( QIODevice::ReadOnly ) )
+		return false;
+	png = f.readAll();
+	return StreamAgent::pngSize( png, w, h );
+}
+
+bool StreamAgent::pngSize( const QByteArray& png, int& w, int& h )
+{
+	static const char s_sig[] = "\x89PNG\r\n\x1a\n";
+	static const char s_end[] = "\0\0\0\0IEND\xae\x42\x60\x82";
+	// Signature (8), IHDR chunk (25), IEND chunk (12)
+	if( png.size() < 8 + 25 + 12 )
+		return false;
+	const uchar* p = (const uchar*)png.constData();
+	if( ::memcmp( p, s_sig, 8 ) != 0 || ::memcmp( p + 8, "\0\0\0\x0dIHDR", 8 ) != 0 ||
+		::memcmp( p + png.size() - 12, s_end, 12 ) != 0 ) // truncated by a failed exportPicture
+		return false;
+	const quint32 pw = ( quint32(p[16]) << 24 ) | ( quint32(p[17]) << 16 ) | ( quint32(p[18]) << 8 ) | p[19];
+	const quint32 ph = ( quint32(p[20]) << 24 ) | ( quint32(p[21]) << 16 ) | ( quint32(p[22]) << 8 ) | p[23];
+	const int depth = p[24];
+	const int color = p[25];
+	if( pw == 0 || ph == 0 || pw > 0x7fff || ph > 0x7fff )
+		return false;
+	if( depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16 )
+		return false;
+	if( color != 0 && color != 2 && color != 3 && color != 4 && color != 6 )
+		return false;
+	if( p[26] != 0 || p[27] != 0 || p[28] > 1 ) // compression, filter, interlace
+		return false;
+	w = pw;
+	h = ph;
+	return true;
+}
+
+void StreamAgent::loadImg( const QString& filePath, bool deleteAfterwards, const QByteArray& name )
 {
 	QImage img;
-	onTrace( "LoadImg " + filePath );
-	if( !img.load( filePath ) )
+	if( s_trace )
+		onTrace( "LoadImg " + filePath );
+	const quint64 start = Metrics::now();
+	d_metrics.addImage();
+	d_metrics.d_imageBytes += QFileInfo( filePath ).size();
+	QByteArray png;
+	int w, h;
+	if( d_passthrough && readPng( filePath, png, w, h ) )
+	{
+		// DOORS already wrote a PNG; decoding and encoding it again only costs time
+		d_metrics.addTime( Metrics::Image, start );
+		writeCell( name, Stream::DataCell().setImg( png ) );
+		if( Tracer::isOn() )
+			Tracer::complete( "loadImg", "image", d_track, start, Metrics::now() );
+		if( deleteAfterwards && !removeTemp( filePath ) )
+			onError( "StreamAgent::loadImg: not removing file outside of the temp directory " + filePath );
+		return;
+	}
+	if( !( png.isEmpty() ? img.load( filePath ) : img.loadFromData( png ) ) )
 	{
 		img.load( ":/DoorScopeEtl/img_placeholder.png" );
+		d_metrics.addTime( Metrics::Image, start );
 		writeCell( name, Stream::DataCell().setImage( img ) );
 		onError( "StreamAgent::loadImg: cannot load image file" );
+		if( Tracer::isOn() )
+			Tracer::complete( "loadImg", "image", d_track, start, Metrics::now() );
 		return;
 	}
+	d_metrics.addTime( Metrics::Image, start );
 	writeCell( name, Stream::DataCell().setImage( img ) );
-	if( deleteAfterwards )
-		QFile::remove( filePath );
+	if( Tracer::isOn() )
+		Tracer::complete( "loadImg", "image", d_track, start, Metrics::now() );
+	if( deleteAfterwards && !removeTemp( filePath ) )
+		onError( "StreamAgent::loadImg: not removing file outside of the temp directory " + filePath );
 }
 
-void StreamAgent::readImg( QString filePath, int w, int h, QByteArray name )
+void StreamAgent::readImg( const QString& filePath, int w, int h, const QByteArray& name )
 {
 	QImage img;
-	onTrace( "LoadImg " + filePath );
-	if( !img.load( filePath ) )
+	if( s_trace )
+		onTrace( "LoadImg " + filePath );
+	const quint64 start = Metrics::now();
+	d_metrics.addImage();
+	d_metrics.d_imageBytes += QFileInfo( filePath ).size();
+	QByteArray png;
+	int pw, ph;
+	if( d_passthrough && readPng( filePath, png, pw, ph ) &&
+		( w <= 0 || h <= 0 || ( w == pw && h == ph ) ) )
+	{
+		// Only decoded if it has to be scaled
+		d_metrics.addTime( Metrics::Image, start );
+		writeCell( name, Stream::DataCell().setImg( png ) );
+		if( Tracer::isOn() )
+			Tracer::complete( "readImg", "image", d_track, start, Metrics::now() );
+		return;
+	}
+	if( !( png.isEmpty() ? img.load( filePath ) : img.loadFromData( png ) ) )
 	{
 		img.load( ":/DoorScopeEtl/img_placeholder.png" );
+		d_metrics.addTime( Metrics::Image, start );
 		writeCell( name, Stream::DataCell().setImage( img ) );
 		onError( "StreamAgent::readImg: cannot load image file" );
+		if( Tracer::isOn() )
+			Tracer::complete( "readImg", "image", d_track, start, Metrics::now() );
 		return;
 	}
 	if( w > 0 && h > 0 )
 		img = img.scaled( QSize( w, h ), Qt::KeepAspectRatio, Qt::SmoothTransformation );
+	d_metrics.addTime( Metrics::Image, start );
+	writeCell( name, Stream::DataCell().setImage( img ) );
+	if( Tracer::isOn() )
+		Tracer::complete( "readImg", "image", d_track, start, Metrics::now() );
+}
+
+void StreamAgent::writeImg( const QImage& img, const QByteArray& name )
+{
+	const quint64 start = Metrics::now();
+	d_metrics.addImage();
 	writeCell( name, Stream::DataCell().setImage( img ) );
+	if( Tracer::isOn() )
+		Tracer::complete( "writeImg", "image", d_track, start, Metrics::now() );
 }
 
-void StreamAgent::writeString( QString value, QByteArray name )
+void StreamAgent::writePng( const QByteArray& png, const QByteArray& name )
 {
-	writeCell( name, Stream::DataCell().setString( value ) );
+	const quint64 start = Metrics::now();
+	d_metrics.addImage();
+	writeCell( name, Stream::DataCell().setImg( png ) );
+	if( Tracer::isOn() )
+		Tracer::complete( "writePng", "image", d_track, start, Metrics::now() );
 }
 
-void StreamAgent::writeHtml( QString value, QByteArray name )
+void StreamAgent::writeString( const QString& value, const QByteArray& name )
 {
-	writeCell( name, Stream::DataCell().setHtml( value ) );
+	d_cell.setString( value );
+	writeCell( name, d_cell );
 }
 
-void StreamAgent::pasteString( QByteArray name )
+void StreamAgent::writeHtml( const QString& value, const QByteArray& name )
+{
+	d_cell.setHtml( value );
+	writeCell( name, d_cell );
+}
+
+void StreamAgent::pasteString( const QByteArray& name )
 {
 	writeCell( name, Stream::DataCell().setString( QApplication::clipboard()->text() ) );
 }
 
-void StreamAgent::writeReal( double value, QByteArray name )
+void StreamAgent::mappedString( const QString& filePath, int len, bool deleteAfterwards, const QByteArray& name )
+{
+	if( s_trace )
+		onTrace( "MappedString " + filePath );
+	QFile f( filePath );
+	if( !f.open( QIODevice::ReadOnly ) )
+	{
+		onError( "StreamAgent::mappedString: cannot open file " + filePath );
+		return;
+	}
+	qint64 size = f.size();
+	QString str;
+	if( size > 0 )
+	{
+		const uchar* data = f.map( 0, size );
+		QByteArray tmp;
+		if( data == 0 )
+		{
+			tmp = f.readAll();
+			data = (const uchar*)tmp.constData();
+			size = tmp.size();
+		}
+		int off = 0;
+		if( size >= 3 && data[0] == 0xef && data[1] == 0xbb && data[2] == 0xbf )
+			off = 3; // UTF-8 BOM
+		if( size - off != len )
+			onError( QString( "StreamAgent::mappedString: expected %1 bytes, got %2" ).arg( len ).arg( size - off ) );
+		str = QString::fromUtf8( (const char*)data + off, size - off );
+		if( tmp.isEmpty() )
+			f.unmap( (uchar*)data );
+	}
+	f.close();
+	writeCell( name, Stream::DataCell().setString( str ) );
+	if( deleteAfterwards && !removeTemp( filePath ) )
+		onError( "StreamAgent::mappedString: not removing file outside of the temp directory " + filePath );
+}
+
+void StreamAgent::writeRichText( const QString& rtf, const QByteArray& name )
+{
+	// Produces the same BML as writeRichTextSlot in the DXL did
+	const quint64 start = Metrics::now();
+	RichTextReader r;
+	if( !r.parse( rtf ) )
+	{
+		writeString( rtf, name );
+		return;
+	}
+	if( !r.getError().isEmpty() )
+		onError( "StreamAgent::writeRichText: " + r.getError() );
+	if( !r.isFormatted() )
+	{
+		writeString( r.getPlainText(), name );
+		return;
+	}
+	startEmbed();
+	const QList<RichTextReader::Paragraph>& pars = r.getParagraphs();
+	for( int i = 0; i < pars.size(); i++ )
+	{
+		const RichTextReader::Paragraph& p = pars[i];
+		startFrame( "par" );
+		if( p.d_indent > 0 )
+			writeInt( p.d_indent, "il" ); // in Twips bzw. x*360
+		if( p.d_bullet )
+		{
+			writeBool( true, "bu" );
+			writeInt( p.d_bulletStyle, "bs" );
+		}
+		for( int j = 0; j < p.d_runs.size(); j++ )
+		{
+			const RichTextReader::Run& rt = p.d_runs[j];
+			startFrame( "rt" );
+			if( rt.isPicture() )
+			{
+				if( rt.d_png.isEmpty() )
+					writeImg( rt.d_img, "ole" );
+				else if( d_passthrough )
+					writePng( rt.d_png, "ole" );
+				else
+					writeImg( QImage::fromData( rt.d_png, "PNG" ), "ole" );
+				writeReal( rt.d_width, "~width" );
+				writeReal( rt.d_height, "~height" );
+			}else if( !rt.d_url.isEmpty() )
+				writeString( rt.d_url, "url" );
+			else
+			{
+				if( rt.d_format.test( RichTextReader::Italic ) )
+					writeChar( 'i' );
+				if( rt.d_format.test( RichTextReader::Bold ) )
+					writeChar( 'b' );
+				if( rt.d_format.test( RichTextReader::Underline ) )
+					writeChar( 'u' );
+				if( rt.d_format.test( RichTextReader::Strikeout ) )
+					writeChar( 'k' );
+				if( rt.d_format.test( RichTextReader::Super ) )
+					writeChar( 'p' );
+				if( rt.d_format.test( RichTextReader::Sub ) )
+					writeChar( 's' );
+				if( rt.d_charset != 0 )
+					writeChar( rt.d_charset );
+				writeString( rt.d_text );
+			}
+			endFrame(); // rt
+		}
+		endFrame(); // par
+	}
+	endEmbed( name );
+	if( Tracer::isOn() )
+		Tracer::complete( "writeRichText", "rtf", d_track, start, Metrics::now() );
+}
+
+void StreamAgent::writeReal( double value, const QByteArray& name )
 {
-	writeCell( name, Stream::DataCell().setDouble( value ) );
+	d_cell.setDouble( value );
+	writeCell( name, d_cell );
 }
 
-void StreamAgent::writeInt( int value, QByteArray name )
+void StreamAgent::writeInt( int value, const QByteArray& name )
 {
-	writeCell( name, Stream::DataCell().setInt32( value ) );
+	d_cell.setInt32( value );
+	writeCell( name, d_cell );
 }
 
-void StreamAgent::writeDate( QDateTime value, QByteArray name )
+void StreamAgent::writeDate( const QDateTime& value, const QByteArray& name )
 {
-	writeCell( name, Stream::DataCell().setDateTime( value ) );
+	d_cell.setDateTime( value );
+	writeCell( name, d_cell );
 }
 
-void StreamAgent::writeChar( char value, QByteArray name )
+void StreamAgent::writeChar( char value, const QByteArray& name )
 {
-	writeCell( name, Stream::DataCell().setUInt8( value ) );
+	d_cell.setUInt8( value );
+	writeCell( name, d_cell );
 }
 
-void StreamAgent::writeBool( bool value, QByteArray name )
+void StreamAgent::writeBool( bool value, const QByteArray& name )
 {
-	writeCell( name, Stream::DataCell().setBool( value ) );
+	d_cell.setBool( value );
+	writeCell( name, d_cell );
 }
 
-void StreamAgent::startFrame( QByteArray name )
+void StreamAgent::startFrame( const QByteArray& name )
 {
 	try
 	{
-		onTrace( "StartFrame " + name );
-		if( name.isNull() )
+		if( s_trace )
+			onTrace( "StartFrame " + name );
+		const quint64 start = Metrics::now();
+		if( name == "obj" )
+			d_metrics.addObject();
+		if( d_outs.size() == 1 )
+		{
+			callSinks( SinkStartFrame, name );
+		}else if( name.isNull() )
 		{
 			d_outs.back().d_out.startFrame();
-			return;
 		}else
 		{
 			const QByteArray n = name;
 			d_outs.back().d_out.startFrame( n.data() );
 		}
+		d_metrics.addTime( Metrics::Write, start );
 	}catch( Stream::StreamException& e )
 	{
 		onError( QString( "StreamAgent::startFrame %1 %2" ).arg( e.getCode() ).arg( QString( e.getMsg() ) ) );
@@ -193,8 +654,15 @@ void StreamAgent::endFrame()
 {
 	try
 	{
-		onTrace( "EndFrame" );
-		d_outs.back().d_out.endFrame();
+		if( s_trace )
+			onTrace( "EndFrame" );
+		const quint64 start = Metrics::now();
+		if( d_outs.size() == 1 )
+		{
+			callSinks( SinkEndFrame );
+		}else
+			d_outs.back().d_out.endFrame();
+		d_metrics.addTime( Metrics::Write, start );
 	}catch( Stream::StreamException& e )
 	{
 		onError( QString( "StreamAgent::endFrame %1 %2" ).arg( e.getCode() ).arg( QString( e.getMsg() ) ) );
@@ -212,7 +680,14 @@ void StreamAgent::startEmbed()
 	try
 	{
 		d_outs.append( Slot() );
-		onTrace( "StartEmbed" );
+		// The embedded stream is collected in a SpillBuffer instead of the DataWriter's
+		// internal buffer so that oversized embeds don't have to be held in memory.
+		d_outs.back().d_spill = new SpillBuffer( d_spillThreshold );
+		d_outs.back().d_out.setDevice( d_outs.back().d_spill, false );
+		d_metrics.enterEmbed( d_outs.size() - 1 );
+		d_outs.back().d_start = Metrics::now();
+		if( s_trace )
+			onTrace( "StartEmbed" );
 	}catch( std::exception& e )
 	{
 		onError( "StreamAgent::startEmbed " + QString( e.what() ) );
@@ -222,7 +697,7 @@ void StreamAgent::startEmbed()
 	}
 }
 
-void StreamAgent::endEmbed( QByteArray name )
+void StreamAgent::endEmbed( const QByteArray& name )
 {
 	try
 	{
@@ -231,10 +706,28 @@ void StreamAgent::endEmbed( QByteArray name )
 			onError( "StreamAgent::endEmbed: startEmbed missmatch" );
 			return;
 		}
-		onTrace( "EndEmbed " + name );
-		const QByteArray bml = d_outs.back().d_out.getStream();
+		if( s_trace )
+			onTrace( "EndEmbed " + name );
+		SpillBuffer* spill = d_outs.back().d_spill;
+		const quint64 start = d_outs.back().d_start;
+		d_outs.back().d_out.setDevice( 0 );
 		d_outs.pop_back();
+		if( s_trace && spill->isSpilled() )
+			onTrace( QString( "EndEmbed spilled %1 bytes to disk" ).arg( spill->size() ) );
+		if( spill->spillFailed() )
+			onError( QString( "StreamAgent::endEmbed: cannot spill to a temp file, kept %1 bytes in memory: %2" ).
+				arg( spill->size() ).arg( spill->errorString() ) );
+		// If spilled, bml refers to the mapped temp file and is copied to the parent
+		// stream page by page; so spill must live until writeCell is done.
+		QByteArray bml = spill->data();
+		if( spill->isSpilled() && d_asyncSinks && d_outs.size() == 1 )
+			bml = QByteArray( bml.constData(), bml.size() ); // sink threads outlive the mapping
+
 		writeCell( name, Stream::DataCell().setBml( bml ) );
+		if( Tracer::isOn() )
+			Tracer::complete( "embed", "embed", d_track, start, Metrics::now(),
+				"\"bytes\":" + QByteArray::number( bml.size() ) );
+		delete spill;
 	}catch( std::exception& e )
 	{
 		onError( "StreamAgent::endEmbed " + QString( e.what() ) );
@@ -243,3 +736,34 @@ void StreamAgent::endEmbed( QByteArray name )
 		onError(  "StreamAgent::endEmbed: unknown exception" );
 	}
 }
+
+void StreamAgent::startDescriptor( const QString& key )
+{
+	QHash<QString,int>::const_iterator i = d_descriptors.find( key );
+	int id;
+	if( i == d_descriptors.end() )
+	{
+		id = d_descriptors.size();
+		d_descriptors.insert( key, id );
+	}else
+		id = i.value(); // redefinition; readers use the latest one
+	startFrame( "desc" );
+	writeInt( id, "~descId" );
+}
+
+void StreamAgent::endDescriptor()
+{
+	endFrame();
+}
+
+void StreamAgent::useDescriptor( const QString& key, const QByteArray& name )
+{
+	QHash<QString,int>::const_iterator i = d_descriptors.find( key );
+	if( i == d_descriptors.end() )
+	{
+		onError( "StreamAgent::useDescriptor: unknown descriptor " + key );
+		return;
+	}
+	writeInt( i.value(), name );
+}
+
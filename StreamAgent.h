@@ -20,7 +20,14 @@
 #include <QObject>
 #include <Stream/DataWriter.h>
 #include <QMap>
+#include <QHash>
 #include <QLinkedList>
+#include <QMutex>
+#include "Metrics.h"
+
+class SpillBuffer;
+class OutputSink;
+class QImage;
 
 class StreamAgent : public QObject
 {
@@ -29,44 +36,91 @@ public:
     StreamAgent(QObject *parent = 0);
 	~StreamAgent();
 
-	void onError( QString msg ) { log( msg, 2 ); }
-	void onStatus( QString msg ) { log( msg, 1 ); }
-	void onTrace( QString msg ) { log( msg, 0 ); }
-	void readImg( QString filePath, int w = 0, int h = 0, QByteArray name = QByteArray() ); 
+	void onError( const QString& msg ) { log( msg, 2 ); }
+	void onStatus( const QString& msg ) { log( msg, 1 ); }
+	void onTrace( const QString& msg ) { log( msg, 0 ); }
+	// Trace messages are only built if on; shared by all agents
+	static void setTrace( bool on ) { s_trace = on; }
+	static bool isTrace() { return s_trace; }
+	void readImg( const QString& filePath, int w = 0, int h = 0, const QByteArray& name = QByteArray() ); 
+	void writeImg( const QImage& img, const QByteArray& name = QByteArray() ); // already decoded, e.g. by HtmlImporter
+	void writePng( const QByteArray& png, const QByteArray& name = QByteArray() ); // checked with pngSize
+	// Checks signature, IHDR and IEND of a PNG without decoding it; returns false if it is none or broken
+	static bool pngSize( const QByteArray& png, int& w, int& h );
+	// Files passed by clients are only removed if they are in the temp directory
+	static bool removeTemp( const QString& filePath );
+	const QString& getName() const { return d_name; }
+	void setTrack( int id ) { d_track = id; } // used by Tracer
+	void setPassthrough( bool on ) { d_passthrough = on; } // ImagePassthrough until the next open
+	int getEmbedDepth() const { return d_outs.size() - 1; }
+	qint64 getOutputSize() const; // sum of the sink files, -1 if none
+
+	Metrics d_metrics;
 signals:
 	void log( QString, int kind );
 public slots:
-	void open( QString name );
+	void open( const QString& name );
 	void close();
+	// Collects the top level stream in memory instead of the configured sinks; the
+	// recording is appended to another agent's stream with replay
+	void record( const QString& name );
+	void replay( StreamAgent& recorder );
 
 	// name darf empty sein
 	// Doors-Typen: string|int|char|bool|OleAutoObj, real, Date
 	// DOORS data is stored in ANSI format
-	void writeString( QString val, QByteArray name = QByteArray() ); 
-	void writeHtml( QString val, QByteArray name = QByteArray() ); 
-	void writeInt( int val, QByteArray name = QByteArray() ); 
-	void writeChar( char val, QByteArray name = QByteArray() ); 
-	void writeBool( bool val, QByteArray name = QByteArray() ); 
-	void loadImg( QString filePath, bool deleteAfterwards = true, QByteArray name = QByteArray() ); 
-	void writeReal( double val, QByteArray name = QByteArray() ); 
-	void writeDate( QDateTime val, QByteArray name = QByteArray() );  
+	void writeString( const QString& val, const QByteArray& name = QByteArray() ); 
+	void writeHtml( const QString& val, const QByteArray& name = QByteArray() ); 
+	void writeInt( int val, const QByteArray& name = QByteArray() ); 
+	void writeChar( char val, const QByteArray& name = QByteArray() ); 
+	void writeBool( bool val, const QByteArray& name = QByteArray() ); 
+	void loadImg( const QString& filePath, bool deleteAfterwards = true, const QByteArray& name = QByteArray() ); 
+	void writeReal( double val, const QByteArray& name = QByteArray() ); 
+	void writeDate( const QDateTime& val, const QByteArray& name = QByteArray() );  
 
-	void pasteString( QByteArray name = QByteArray() ); 
+	void pasteString( const QByteArray& name = QByteArray() ); 
+	// Large strings are passed in a UTF-8 temp file instead of the socket; see removeTemp
+	void mappedString( const QString& filePath, int len, bool deleteAfterwards = true, const QByteArray& name = QByteArray() ); 
+	// Raw DOORS rich text; written as embedded par/rt frames, or as a plain string if unformatted
+	void writeRichText( const QString& rtf, const QByteArray& name = QByteArray() ); 
 
-	void startFrame( QByteArray name = QByteArray() ); 
+	void startFrame( const QByteArray& name = QByteArray() ); 
 	void endFrame(); 
 
 	void startEmbed(); 
-	void endEmbed( QByteArray name = QByteArray() ); 
+	void endEmbed( const QByteArray& name = QByteArray() ); 
+
+	// Module and link module data shared by many links is written once per stream as a
+	// "desc" frame with a ~descId slot; the links refer to it by an int slot holding the id
+	void startDescriptor( const QString& key ); 
+	void endDescriptor(); 
+	void useDescriptor( const QString& key, const QByteArray& name ); 
 private:
 	void writeCell( const QByteArray& name, const Stream::DataCell& value );
+	void clearOuts();
+	void clearSinks();
+	enum SinkCall { SinkSlot, SinkStartFrame, SinkEndFrame };
+	void callSinks( SinkCall, const QByteArray& name = QByteArray(), const Stream::DataCell& value = Stream::DataCell() );
+	void dropSink( int i, const char* where, const QString& error );
 
 	struct Slot
 	{
 		Stream::DataWriter d_out;
-		Slot():d_out(0) {}
+		SpillBuffer* d_spill; // only used by embeds; owned by StreamAgent
+		quint64 d_start;
+		Slot():d_out(0),d_spill(0),d_start(0) {}
 	};
-	QLinkedList<Slot> d_outs;
+	QLinkedList<Slot> d_outs; // front is unused; top level writes go to d_sinks
+	QList<OutputSink*> d_sinks;
+	mutable QMutex d_sinksLock; // list changes vs. getOutputSize from another thread
+	QString d_name;
+	QHash<QString,int> d_descriptors; // key -> ~descId, per stream
+	int d_track;
+	Stream::DataCell d_cell; // reused for scalars and strings
+	static bool s_trace;
+	qint64 d_spillThreshold; // embeds larger than this are spilled to a temp file
+	bool d_asyncSinks;
+	bool d_passthrough; // PNG files are written as they are instead of decoded and encoded again
 };
 
 #endif // STREAMX_H
@@ -0,0 +1,145 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "StreamDictionary.h"
+using namespace StreamDictionary;
+
+static const char s_header[] = { Header, 'd', 's', 'd', 'x', 'd', 'i', 'c', 't', 0 };
+
+Encoder::Encoder( int maxNames, int maxValues, int maxValueLen ):
+	d_nextValue(0),d_maxNames(maxNames),d_maxValues(maxValues),d_maxValueLen(maxValueLen)
+{
+}
+
+void Encoder::reset()
+{
+	d_names.clear();
+	d_values.clear();
+	d_nextValue = 0;
+}
+
+void Encoder::writeHeader( Stream::DataWriter& out )
+{
+	out.writeSlot( Stream::DataCell().setInt32( Version ), s_header, true );
+}
+
+void Encoder::writeSlot( Stream::DataWriter& out, const QByteArray& name, const Stream::DataCell& value )
+{
+	d_wire.truncate( 0 );
+	Stream::DataCell ref;
+	const Stream::DataCell* cell = &value;
+	if( value.getType() == Stream::DataCell::TypeString )
+	{
+		const QString str = value.toString();
+		if( str.size() <= d_maxValueLen )
+		{
+			QHash<QString,int>::iterator i = d_values.find( str );
+			if( i == d_values.end() )
+			{
+				// Candidates which were seen once are bounded as well
+				if( d_values.size() < 4 * d_maxValues )
+					d_values.insert( str, -1 );
+			}else if( i.value() >= 0 )
+			{
+				d_wire += char( ValueRef );
+				ref.setInt32( i.value() );
+				cell = &ref;
+			}else if( d_nextValue < d_maxValues )
+			{
+				d_wire += char( ValueDef );
+				i.value() = d_nextValue++;
+			}
+		}
+	}
+	if( !name.isEmpty() )
+	{
+		QHash<QByteArray,int>::const_iterator i = d_names.find( name );
+		if( i != d_names.end() )
+		{
+			d_wire += char( NameRef );
+			d_wire += QByteArray::number( i.value() );
+		}else if( d_names.size() < d_maxNames )
+		{
+			d_wire += char( NameDef );
+			d_wire += name;
+			d_names.insert( name, d_names.size() );
+		}else
+			d_wire += name;
+	}
+	if( d_wire.isEmpty() )
+		out.writeSlot( *cell );
+	else
+		out.writeSlot( *cell, d_wire.data(), true );
+}
+
+void Decoder::reset()
+{
+	d_names.clear();
+	d_values.clear();
+	d_error.clear();
+	d_active = false;
+}
+
+Decoder::Result Decoder::decode( QByteArray& name, Stream::DataCell& value )
+{
+	if( name.isEmpty() || quint8( name[0] ) > Header )
+		return Ok;
+	if( name == s_header )
+	{
+		d_active = true;
+		return Skip;
+	}
+	if( !d_active )
+		return Ok; // not our stream; control characters are just part of the name
+	int pos = 0;
+	if( name[pos] == ValueRef )
+	{
+		const int i = value.toString().toInt();
+		if( value.getType() != Stream::DataCell::TypeInt32 || i < 0 || i >= d_values.size() )
+		{
+			d_error = "invalid value reference";
+			return Error;
+		}
+		value.setString( d_values[i] );
+		pos++;
+	}else if( name[pos] == ValueDef )
+	{
+		if( value.getType() != Stream::DataCell::TypeString )
+		{
+			d_error = "value definition is not a string";
+			return Error;
+		}
+		d_values.append( value.toString() );
+		pos++;
+	}
+	if( pos < name.size() && name[pos] == NameRef )
+	{
+		bool ok;
+		const int i = name.mid( pos + 1 ).toInt( &ok );
+		if( !ok || i < 0 || i >= d_names.size() )
+		{
+			d_error = "invalid name reference";
+			return Error;
+		}
+		name = d_names[i];
+	}else if( pos < name.size() && name[pos] == NameDef )
+	{
+		name = name.mid( pos + 1 );
+		d_names.append( name );
+	}else
+		name = name.mid( pos );
+	return Ok;
+}
@@ -0,0 +1,79 @@
+#ifndef STREAMDICTIONARY_H
+#define STREAMDICTIONARY_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QHash>
+#include <QVector>
+#include <QString>
+#include <Stream/DataWriter.h>
+
+// Optional dictionary encoding of slot names and short string values in a .dsdx stream.
+// The stream stays a valid Stream; only the slot names carry a control character prefix:
+//	NameDef + name		slot with name; name gets the next name index
+//	NameRef + index		slot with the name of index (decimal)
+//	ValueDef + ...		string value gets the next value index; rest of the name as above
+//	ValueRef + ...		value is an Int32 value index; rest of the name as above
+// Names are defined on first use; values on their second use, so that unique texts don't
+// fill the table. A stream using the dictionary starts with a Header slot.
+namespace StreamDictionary
+{
+	enum Prefix { ValueRef = 0x1a, ValueDef = 0x1b, NameRef = 0x1c, NameDef = 0x1d, Header = 0x1e };
+	enum { Version = 1 };
+
+	class Encoder
+	{
+	public:
+		Encoder( int maxNames = 4096, int maxValues = 65536, int maxValueLen = 256 );
+		void reset();
+		void writeHeader( Stream::DataWriter& );
+		// Same as DataWriter::writeSlot( value, name, true ) resp. writeSlot( value )
+		void writeSlot( Stream::DataWriter&, const QByteArray& name, const Stream::DataCell& value );
+		int getNameCount() const { return d_names.size(); }
+		int getValueCount() const { return d_nextValue; }
+	private:
+		QHash<QByteArray,int> d_names;
+		QHash<QString,int> d_values; // -1: seen once
+		QByteArray d_wire; // reused
+		int d_nextValue;
+		int d_maxNames;
+		int d_maxValues;
+		int d_maxValueLen;
+	};
+
+	class Decoder
+	{
+	public:
+		enum Result { Ok, Skip, Error };
+		Decoder() { reset(); }
+		void reset();
+		// Resolves name and value of a slot in place. Skip for the Header slot.
+		// Streams without Header are passed through unchanged.
+		Result decode( QByteArray& name, Stream::DataCell& value );
+		bool isActive() const { return d_active; }
+		const QString& getError() const { return d_error; }
+		int getNameCount() const { return d_names.size(); }
+		int getValueCount() const { return d_values.size(); }
+	private:
+		QVector<QByteArray> d_names;
+		QVector<QString> d_values;
+		QString d_error;
+		bool d_active;
+	};
+}
+
+#endif // STREAMDICTIONARY_H
@@ -0,0 +1,101 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "Tracer.h"
+#include "Metrics.h"
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+
+bool Tracer::s_on = false;
+static QFile* s_out = 0;
+static QMutex s_lock;
+static quint64 s_origin = 0;
+static int s_sampling = 1;
+static QAtomicInt s_count; // sample() is called by all Pipeline writer threads
+
+bool Tracer::start( const QString& path, int sampling )
+{
+	stop();
+	QMutexLocker lock( &s_lock );
+	s_out = new QFile( path );
+	if( !s_out->open( QIODevice::WriteOnly ) )
+	{
+		delete s_out;
+		s_out = 0;
+		return false;
+	}
+	// The closing bracket is optional in the JSON array format; so the file stays
+	// readable even if the application is killed.
+	s_out->write( "[\n" );
+	s_origin = Metrics::now();
+	s_sampling = ( sampling < 1 ) ? 1 : sampling;
+	s_count = 0;
+	s_on = true;
+	return true;
+}
+
+void Tracer::stop()
+{
+	QMutexLocker lock( &s_lock );
+	s_on = false;
+	if( s_out )
+	{
+		s_out->write( "{}]\n" );
+		delete s_out;
+		s_out = 0;
+	}
+}
+
+bool Tracer::sample()
+{
+	return quint32( s_count.fetchAndAddRelaxed( 1 ) ) % quint32( s_sampling ) == 0;
+}
+
+static inline QByteArray micros( quint64 ns )
+{
+	return QByteArray::number( double( ns ) / 1000.0, 'f', 3 );
+}
+
+void Tracer::complete( const char* name, const char* cat, int track,
+	quint64 start, quint64 end, const QByteArray& args )
+{
+	QMutexLocker lock( &s_lock );
+	if( s_out == 0 || start < s_origin )
+		return;
+	QByteArray line = "{\"name\":\"";
+	line += name;
+	line += "\",\"cat\":\"";
+	line += cat;
+	line += "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + QByteArray::number( track );
+	line += ",\"ts\":" + micros( start - s_origin );
+	line += ",\"dur\":" + micros( end - start );
+	if( !args.isEmpty() )
+		line += ",\"args\":{" + args + "}";
+	line += "},\n";
+	s_out->write( line );
+}
+
+void Tracer::nameTrack( int track, const QString& name )
+{
+	QMutexLocker lock( &s_lock );
+	if( s_out == 0 )
+		return;
+	QByteArray line = "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + QByteArray::number( track );
+	line += ",\"args\":{\"name\":" + Metrics::jsonString( name ) + "}},\n";
+	s_out->write( line );
+}
@@ -0,0 +1,46 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScopeEtl application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QString>
+#include <QByteArray>
+
+// Writes trace events in the Chrome/Perfetto JSON format (see chrome://tracing).
+// Each connection is a track (tid). When tracing is off all calls reduce to a
+// check of a static bool. Per-command spans are sampled, i.e. only every n-th
+// command is recorded; coarse spans (batches, images, embeds, flushes) are always recorded.
+class Tracer
+{
+public:
+	static bool start( const QString& path, int sampling = 1 );
+	static void stop();
+	static bool isOn() { return s_on; }
+
+	// Returns true for every n-th call; use before recording a per-command span
+	static bool sample();
+
+	// Records a complete event; start and end are Metrics::now() values
+	static void complete( const char* name, const char* cat, int track,
+		quint64 start, quint64 end, const QByteArray& args = QByteArray() );
+	// Names the track in the viewer
+	static void nameTrack( int track, const QString& name );
+private:
+	static bool s_on;
+};
+
+#endif // TRACER_H
@@ -16,6 +16,8 @@
 
 #include <QtGui/QApplication>
 #include "DoorScopeEtl.h"
+#include "ShardedServer.h"
+#include "Publisher.h"
 #include <QPlastiqueStyle>
 #include <QtPlugin>
 
@@ -29,8 +31,27 @@ int main(int argc, char *argv[])
 	a.setOrganizationDomain( "rochus.keller@doorscope.ch" );
 	a.setApplicationName( "ETL" );
 	a.setStyle( new QPlastiqueStyle() );
+
+	// -worker <index> <port> <localhostOnly> is used by the Supervisor, -workers <n> by the user
+	const QStringList args = a.arguments();
+	const int worker = args.indexOf( "-worker" );
+	if( worker != -1 && worker + 3 < args.size() )
+	{
+		Worker wp( args[worker + 1].toInt() );
+		if( !wp.listen( args[worker + 2].toUShort(), args[worker + 3] == "1" ) )
+			return 1;
+		const int res = a.exec();
+		Publisher::instance()->waitForDone();
+		return res;
+	}
+
 	DoorScopeEtl w;
+	const int workers = args.indexOf( "-workers" );
+	if( workers != -1 && workers + 1 < args.size() )
+		w.startWorkers( args[workers + 1].toInt() );
 	w.show();
 	a.connect(&a, SIGNAL(lastWindowClosed()), &a, SLOT(quit()));
-	return a.exec();
+	const int res = a.exec();
+	Publisher::instance()->waitForDone(); // don't leave files in the staging directory
+	return res;
 }